@@ -19,6 +19,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
+#include "trace.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
@@ -39,6 +40,7 @@ binit(void)
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  addwchan("buf", bcache.buf, sizeof(bcache.buf));
 
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
@@ -95,6 +97,7 @@ bread(uint dev, uint blockno)
   struct buf *b;
 
   b = bget(dev, blockno);
+  trace(TR_BREAD, blockno, b->valid);
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,12 +105,23 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for the indicated block without
+// reading it from disk, for a caller that is about to
+// overwrite all of b->data. The caller sets b->valid
+// once it has filled b->data.
+struct buf*
+bfresh(uint dev, uint blockno)
+{
+  return bget(dev, blockno);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
+  trace(TR_BWRITE, b->blockno, 0);
   virtio_disk_rw(b, 1);
 }
 
@@ -2,8 +2,12 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct kmem_cache;
 struct pipe;
 struct proc;
+struct rwlock;
+struct seqlock;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -13,6 +17,7 @@ struct page;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bfresh(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
@@ -34,6 +39,14 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int, int);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+
+// futex.c
+void            futexinit(void);
+int             futex_wait(uint64, int);
+int             futex_wake(uint64, int);
 
 // fs.c
 void            fsinit(int);
@@ -44,7 +57,10 @@ struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            isync(void);
 void            iunlock(struct inode*);
+void            ilockshared(struct inode*);
+void            iunlockshared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
@@ -70,35 +86,76 @@ void            kinit(void);
 void            lru_init(void);
 void            lru_add(uint64);
 void            lru_remove(uint64);
+void            file_lru_add(uint64);
+void            file_lru_remove(uint64);
+void            file_lru_hold(uint64);
+uint64          file_lru_evict(void);
 extern struct page pages[];
 extern struct spinlock swap_lock;
+extern struct spinlock lru_lock;
 extern int swap_bitmap[];
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
+void            end_opn(int);
 void            end_op(void);
 
+// pcache.c
+void            pcacheinit(void);
+uint64          pcache_lookup(struct inode*, uint);
+void            pcache_insert(struct inode*, uint, uint64);
+void            pcache_put(uint64);
+int             pcache_dirty(struct inode*, uint, uint64, int, uint, int);
+void            pcache_flush(struct inode*);
+void            pcache_commit(void);
+void            pcache_drop(struct inode*);
+void*           pcache_evict(void);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int);
+int             pipewrite(struct pipe*, int, uint64, int);
 
 // printf.c
 int            printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// prof.c
+extern int      profiling;
+void            profinit(void);
+void            profsample(uint64, int);
+int             profile(int);
+int             profread(uint64, int);
+
+// ring.c
+void            ringinit(void);
+uint64          ringsetup(void);
+int             ringenter(int);
+void            ringfree(pagetable_t);
+
+// trace.c
+extern uint     tracemask;
+void            traceinit(void);
+void            tracerecord(int, uint64, uint64);
+int             tracectl(uint);
+int             traceread(uint64, int);
+#define trace(ev, a0, a1) \
+  do { if(tracemask & (1 << (ev))) tracerecord((ev), (a0), (a1)); } while(0)
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+uint64          growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t, uint64, uint64);
 int             kill(int);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
@@ -112,7 +169,24 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeupn(void*, int);
+void            addwchan(char*, void*, uint64);
+void            addwchancache(char*, struct kmem_cache*);
 void            yield(void);
+void            schedtick(void);
+void            schedboost(void);
+int             setpriority(int, int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+int             threadcount(void);
+void            vmlock(void);
+void            vmunlock(void);
+int             fdalloc(struct file*);
+struct file*    fdget(int, int*);
+void            fdput(struct file*, int);
+struct file*    fdtake(int);
+struct inode*   cwdget(void);
+struct inode*   cwdswap(struct inode*);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
@@ -120,6 +194,17 @@ void            procdump(void);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+int             kmem_cache_shrink(struct kmem_cache*);
+int             kmem_reap(void);
+void            kmem_drain(void);
+void*           kmalloc(uint);
+void            kmfree(void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -127,12 +212,31 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             lockstat(uint64, int);
+void            lockstat_sleep(struct spinlock*, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            acquiresleepshared(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
+int             holdingsleepshared(struct sleeplock*);
+
+// rwlock.c
+void            initrwlock(struct rwlock*, char*);
+void            acquireread(struct rwlock*);
+void            releaseread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+void            releasewrite(struct rwlock*);
+void            initseqlock(struct seqlock*, char*);
+void            writeseqlock(struct seqlock*);
+void            writesequnlock(struct seqlock*);
+void            writeseqbegin(struct seqlock*);
+void            writeseqend(struct seqlock*);
+uint            readseqbegin(struct seqlock*);
+int             readseqretry(struct seqlock*, uint);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -151,17 +255,30 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// sysfile.c
+int             fileopen(char*, int);
+
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
+extern struct seqlock tickslock;
+void            settimer(uint64);
+void            timerrun(void);
+void            timeridle(void);
+void            clockupdate(void);
+uint            readticks(void);
+void            wakeat(uint);
+uint64          uptimens(void);
+void            sendipi(int);
+void            tlbflush(pagetable_t);
 void            usertrapret(void);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartwrite(char*, int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -170,6 +287,7 @@ void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
+int             mapkpage(pagetable_t, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
@@ -183,6 +301,10 @@ uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             uvmloan(pagetable_t, uint64, uint64*);
+int             uvmcow(pagetable_t, uint64);
+int             uvmswapin(pagetable_t, uint64, pte_t*);
+uint64          uvmpin(pagetable_t, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -190,6 +312,11 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// vdata.c
+void            vdatainit(void);
+void            vdataupdate(uint);
+int             vdatamap(pagetable_t);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
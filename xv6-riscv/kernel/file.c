@@ -12,17 +12,22 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
+// File structs are allocated on demand from filecache,
+// and freed on last close. ftable.lock protects f->ref.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *filecache;
+  int n;           // files allocated, at most NFILE
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.filecache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -32,15 +37,21 @@ filealloc(void)
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.n == NFILE){
+    release(&ftable.lock);
+    return 0;
   }
+  ftable.n++;
   release(&ftable.lock);
-  return 0;
+
+  if((f = kmem_cache_alloc(ftable.filecache)) == 0){
+    acquire(&ftable.lock);
+    ftable.n--;
+    release(&ftable.lock);
+    return 0;
+  }
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +80,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
+  ftable.n--;
   release(&ftable.lock);
+  kmem_cache_free(ftable.filecache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -91,9 +102,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -101,27 +112,143 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Lock f's inode to read it at *poff. Readers share the lock,
+// except that a read at f->off that other threads or processes
+// may be making too needs it alone, to keep f->off consistent.
+// Returns whether the lock is held alone, for iunlockread().
+static int
+ilockread(struct file *f, uint *poff)
+{
+  if(poff == &f->off && (f->ref > 1 || threadcount() > 1)){
+    ilock(f->ip);
+    return 1;
+  }
+  ilockshared(f->ip);
+  return 0;
+}
+
+static void
+iunlockread(struct file *f, int alone)
+{
+  if(alone)
+    iunlock(f->ip);
+  else
+    iunlockshared(f->ip);
+}
+
+// Read the buffers in iov from inode-backed file f at *poff,
+// under a single ilockread(). Stops at the first short read.
+// Returns the number of bytes read, or -1.
+static int
+readiov(struct file *f, int user_dst, struct iovec *iov, int iovcnt, uint *poff)
+{
+  int i, r, alone, tot = 0;
+
+  alone = ilockread(f, poff);
+  for(i = 0; i < iovcnt; i++){
+    r = readi(f->ip, user_dst, (uint64)iov[i].iov_base, *poff, iov[i].iov_len);
+    if(r < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    *poff += r;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  iunlockread(f, alone);
+  return tot;
+}
+
+// Log blocks a write of n bytes to an inode can dirty:
+// the data blocks plus 2 blocks of slop for non-aligned
+// writes, the i-node, the indirect block, and the free
+// bitmap blocks it may allocate from. Data blocks are
+// logged only if the page cache has no room for them,
+// but the reservation also bounds the blocks it must
+// write at commit (pcache.c).
+#define WRITEBLOCKS(n) ((n)/BSIZE + 2 + 1 + 1 + FSSIZE/BPB + 1)
+
+// Write the buffers in iov to inode-backed file f at *poff,
+// packing them into as few log transactions as possible:
+// each transaction reserves just the log space its bytes
+// need, up to all of the log but room for one other op.
+// Returns the number of bytes written, or -1 on error.
+static int
+writeiov(struct file *f, int user_src, struct iovec *iov, int iovcnt, uint *poff)
+{
+  // most bytes per transaction: the log, less room for one
+  // other op and this write's fixed overhead.
+  int max = (LOGSIZE - MAXOPBLOCKS - WRITEBLOCKS(0)) * BSIZE;
+  int i, done = 0, tot = 0, left = 0, room, nblocks, n1, r;
+
+  for(i = 0; i < iovcnt; i++)
+    left += iov[i].iov_len;
+
+  i = 0;
+  while(i < iovcnt){
+    room = left < max ? left : max;
+    nblocks = WRITEBLOCKS(room);
+    begin_opn(nblocks);
+    ilock(f->ip);
+    while(i < iovcnt && room > 0){
+      if(done == iov[i].iov_len){
+        i++;
+        done = 0;
+        continue;
+      }
+      n1 = iov[i].iov_len - done;
+      if(n1 > room)
+        n1 = room;
+      r = writei(f->ip, user_src, (uint64)iov[i].iov_base + done, *poff, n1);
+      if(r > 0){
+        *poff += r;
+        done += r;
+        tot += r;
+        left -= r;
+        room -= r;
+      }
+      if(r != n1){
+        // error from writei
+        iunlock(f->ip);
+        end_opn(nblocks);
+        return -1;
+      }
+    }
+    iunlock(f->ip);
+    end_opn(nblocks);
+    // skip trailing empty buffers without another transaction.
+    while(i < iovcnt && done == iov[i].iov_len){
+      i++;
+      done = 0;
+    }
+  }
+  return tot;
+}
+
 // Read from file f.
-// addr is a user virtual address.
-int
-fileread(struct file *f, uint64 addr, int n)
+// If user_dst==1, addr is a user virtual address;
+// otherwise, addr is a kernel address.
+static int
+fileread1(struct file *f, int user_dst, uint64 addr, int n)
 {
-  int r = 0;
+  int r = 0, alone;
 
   if(f->readable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    alone = ilockread(f, &f->off);
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
       f->off += r;
-    iunlock(f->ip);
+    iunlockread(f, alone);
   } else {
     panic("fileread");
   }
@@ -130,49 +257,27 @@ fileread(struct file *f, uint64 addr, int n)
 }
 
 // Write to file f.
-// addr is a user virtual address.
-int
-filewrite(struct file *f, uint64 addr, int n)
+// If user_src==1, addr is a user virtual address;
+// otherwise, addr is a kernel address.
+static int
+filewrite1(struct file *f, int user_src, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
-      }
-      i += r;
-    }
-    ret = (i == n ? n : -1);
+    struct iovec iov = { (void*)addr, n };
+    if(n < 0)
+      return -1;
+    ret = writeiov(f, user_src, &iov, 1, &f->off);
   } else {
     panic("filewrite");
   }
@@ -180,3 +285,126 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read from file f.
+// addr is a user virtual address.
+int
+fileread(struct file *f, uint64 addr, int n)
+{
+  return fileread1(f, 1, addr, n);
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return filewrite1(f, 1, addr, n);
+}
+
+// Read into the user buffers in iov (already copied into the
+// kernel) from file f. An inode is read at byte offset off,
+// or at (and advancing) f->off if off is negative.
+// Pipes and devices have no offset, and return after the first
+// read that gets anything, since another could wait forever.
+int
+filereadv(struct file *f, struct iovec *iov, int iovcnt, int off)
+{
+  int i;
+  uint uoff;
+
+  if(f->readable == 0)
+    return -1;
+
+  if(f->type == FD_INODE){
+    if(off < 0)
+      return readiov(f, 1, iov, iovcnt, &f->off);
+    uoff = off;
+    return readiov(f, 1, iov, iovcnt, &uoff);
+  }
+  if(off >= 0)
+    return -1;
+  for(i = 0; i < iovcnt; i++)
+    if(iov[i].iov_len > 0)
+      return fileread1(f, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
+  return 0;
+}
+
+// Write the user buffers in iov to file f,
+// with the same offset rules as filereadv().
+int
+filewritev(struct file *f, struct iovec *iov, int iovcnt, int off)
+{
+  int i, r, tot;
+  uint uoff;
+
+  if(f->writable == 0)
+    return -1;
+
+  if(f->type == FD_INODE){
+    if(off < 0)
+      return writeiov(f, 1, iov, iovcnt, &f->off);
+    uoff = off;
+    return writeiov(f, 1, iov, iovcnt, &uoff);
+  }
+  if(off >= 0)
+    return -1;
+  for(tot = 0, i = 0; i < iovcnt; i++){
+    r = filewrite1(f, 1, (uint64)iov[i].iov_base, iov[i].iov_len);
+    if(r < 0)
+      return -1;
+    tot += r;
+    if(r != iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+// Move up to n bytes from file in to file out without
+// copying through user memory, a page at a time through a
+// kernel buffer. An inode is read at byte offset off, or at
+// (and advancing) in->off if off is negative. Pipes and devices
+// are read as by read(); a short read from them ends the transfer.
+// Returns the number of bytes moved, or -1 if none could be.
+int
+filesplice(struct file *out, struct file *in, int off, int n)
+{
+  char *buf;
+  int r = 0, m, tot, alone;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  for(tot = 0; tot < n; tot += r){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if(in->type == FD_INODE){
+      alone = ilockread(in, off < 0 ? &in->off : (uint*)&off);
+      if(off < 0){
+        if((r = readi(in->ip, 0, (uint64)buf, in->off, m)) > 0)
+          in->off += r;
+      } else if((r = readi(in->ip, 0, (uint64)buf, off, m)) > 0)
+        off += r;
+      iunlockread(in, alone);
+    } else {
+      r = fileread1(in, 0, (uint64)buf, m);
+    }
+    if(r <= 0)
+      break;
+    if(filewrite1(out, 0, (uint64)buf, r) != r){
+      r = -1;
+      break;
+    }
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+
+  kfree(buf);
+  if(tot == 0 && r < 0)
+    return -1;
+  return tot;
+}
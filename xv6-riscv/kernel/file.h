@@ -18,6 +18,11 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct pcnode *pcroot; // cached file pages (pcache.c)
+  int ndirty;            // dirty cached pages, under pcache.lock
+  struct inode *hnext;   // hash chain, under itable.lock
+  struct inode *lrunext; // LRU list of unreferenced inodes, same
+  struct inode *lruprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
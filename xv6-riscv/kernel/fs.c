@@ -15,8 +15,8 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -54,8 +54,9 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bfresh(dev, bno);
   memset(bp->data, 0, BSIZE);
+  bp->valid = 1;
   log_write(bp);
   brelse(bp);
 }
@@ -131,12 +132,12 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to the entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref. An entry
+//   whose ref is zero stays in the table, on an LRU list,
+//   until iget() needs to recycle it.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
@@ -167,27 +168,81 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// entries. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those fields,
+// or the hash and LRU links.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// Code that only reads the inode and its contents, such as
+// read() and pathname lookup, can use ilockshared() instead,
+// so that readers of one inode do not wait for each other.
+
+// Table entries are allocated on demand, up to NINODE of
+// them, and hashed by device and inode number. Once there
+// are NINODE, iget() recycles the least recently used entry
+// with no references.
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH];
+  struct inode *lruhead;   // unreferenced entries, least recent first
+  struct inode *lrutail;
+  int n;                   // entries allocated
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode));
+  addwchancache("inode", itable.cache);
+}
+
+// Append ip to the LRU list. Caller holds itable.lock.
+static void
+ilru_add(struct inode *ip)
+{
+  ip->lrunext = 0;
+  ip->lruprev = itable.lrutail;
+  if(itable.lrutail)
+    itable.lrutail->lrunext = ip;
+  else
+    itable.lruhead = ip;
+  itable.lrutail = ip;
+}
+
+// Remove ip from the LRU list. Caller holds itable.lock.
+static void
+ilru_del(struct inode *ip)
+{
+  if(ip->lruprev)
+    ip->lruprev->lrunext = ip->lrunext;
+  else
+    itable.lruhead = ip->lrunext;
+  if(ip->lrunext)
+    ip->lrunext->lruprev = ip->lruprev;
+  else
+    itable.lrutail = ip->lruprev;
+  ip->lrunext = ip->lruprev = 0;
+}
+
+// Remove ip from the hash. Caller holds itable.lock.
+static void
+ihash_del(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
   }
 }
 
@@ -248,31 +303,56 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *new;
 
   acquire(&itable.lock);
 
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
+  new = 0;
+  for(;;){
+    // Is the inode already in the table? An unreferenced
+    // entry still holds valid contents and cached pages.
+    for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+      if(ip->dev == dev && ip->inum == inum){
+        if(ip->ref++ == 0)
+          ilru_del(ip);
+        if(new){
+          itable.n--;
+          kmem_cache_free(itable.cache, new);
+        }
+        release(&itable.lock);
+        return ip;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
+    if(new || itable.n == NINODE)
+      break;
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    // Allocate a new entry. That may sleep, so let go
+    // of the lock, and look again once it is done.
+    itable.n++;
+    release(&itable.lock);
+    new = kmem_cache_alloc(itable.cache);
+    acquire(&itable.lock);
+    if(new == 0){
+      itable.n--;
+      break;
+    }
+    initsleeplock(&new->lock, "inode");
+  }
 
-  ip = empty;
+  if((ip = new) == 0){
+    // Recycle an inode entry.
+    if((ip = itable.lruhead) == 0)
+      panic("iget: no inodes");
+    ilru_del(ip);
+    ihash_del(ip);
+    pcache_drop(ip);
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -328,9 +408,37 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Lock the given inode for reading only, shared with
+// other readers: enough for readi() and stati(), but not
+// for changing the inode or its contents.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  if(ip->valid == 0){
+    // read it in with the lock held alone. Our reference
+    // keeps it valid once it is.
+    ilock(ip);
+    iunlock(ip);
+  }
+  acquiresleepshared(&ip->lock);
+}
+
+void
+iunlockshared(struct inode *ip)
+{
+  if(ip == 0 || !holdingsleepshared(&ip->lock) || ip->ref < 1)
+    panic("iunlockshared");
+
+  releasesleepshared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode's dirty pages are
+// written out, and the inode table entry can be recycled, or
+// is freed if it holds nothing.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -359,10 +467,62 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  // an unreferenced inode may be recycled at any time, so
+  // write its dirty pages out first. Someone may dirty it
+  // again while itable.lock is let go; check again after.
+  while(ip->ref == 1 && ip->valid && ip->nlink > 0 && ip->ndirty > 0){
+    acquiresleep(&ip->lock);
+    release(&itable.lock);
+    pcache_flush(ip);
+    releasesleep(&ip->lock);
+    acquire(&itable.lock);
+  }
+
+  if(--ip->ref > 0){
+    release(&itable.lock);
+    return;
+  }
+  if(ip->valid){
+    ilru_add(ip);
+  } else {
+    ihash_del(ip);
+    itable.n--;
+    kmem_cache_free(itable.cache, ip);
+  }
   release(&itable.lock);
 }
 
+// Write the dirty pages of every inode in use to disk.
+// Must be inside a transaction, since it drops references.
+void
+isync(void)
+{
+  struct inode *ip, *busy[8];
+  int h, i, n;
+
+  for(h = 0; h < NIHASH; h++){
+    do {
+      // take a reference to a few dirty inodes on chain h,
+      // so that they stay put while they are written.
+      n = 0;
+      acquire(&itable.lock);
+      for(ip = itable.hash[h]; ip && n < NELEM(busy); ip = ip->hnext){
+        if(ip->ref > 0 && ip->ndirty > 0){
+          ip->ref++;
+          busy[n++] = ip;
+        }
+      }
+      release(&itable.lock);
+      for(i = 0; i < n; i++){
+        ilockshared(busy[i]);
+        pcache_flush(busy[i]);
+        iunlockshared(busy[i]);
+        iput(busy[i]);
+      }
+    } while(n == NELEM(busy));
+  }
+}
+
 // Common idiom: unlock, then put.
 void
 iunlockput(struct inode *ip)
@@ -431,6 +591,8 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcache_drop(ip);
+
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -466,15 +628,54 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Return a pinned page holding page pgno of regular file ip,
+// reading it into the page cache on a miss, or 0 if there is
+// no memory for it. Caller must hold ip->lock, perhaps shared:
+// if two readers miss at once, only one page gets cached.
+static uint64
+pageget(struct inode *ip, uint pgno)
+{
+  uint64 pa;
+  uint bn, addr;
+  struct buf *bp;
+  int i;
+
+  if((pa = pcache_lookup(ip, pgno)) != 0)
+    return pa;
+  if((pa = (uint64)kalloc()) == 0)
+    return 0;
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    bn = pgno*(PGSIZE/BSIZE) + i;
+    if(bn*BSIZE >= ip->size){
+      // past EOF; writei() fills it in as the file grows.
+      memset((char*)pa + i*BSIZE, 0, PGSIZE - i*BSIZE);
+      break;
+    }
+    if((addr = bmap(ip, bn)) == 0){
+      kfree((void*)pa);
+      return 0;
+    }
+    bp = bread(ip->dev, addr);
+    memmove((char*)pa + i*BSIZE, bp->data, BSIZE);
+    brelse(bp);
+  }
+  pcache_insert(ip, pgno, pa);
+  return pa;
+}
+
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, perhaps shared.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
+// Regular files are read through the page cache, falling
+// back to the buffer cache if no page can be had.
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
+  uint64 pa;
   struct buf *bp;
+  int r;
 
   if(off > ip->size || off + n < off)
     return 0;
@@ -482,17 +683,23 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
+    if(ip->type == T_FILE && (pa = pageget(ip, off/PGSIZE)) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      r = either_copyout(user_dst, dst, (char*)pa + (off % PGSIZE), m);
+      pcache_put(pa);
+    } else {
+      uint addr = bmap(ip, off/BSIZE);
+      if(addr == 0)
+        break;
+      bp = bread(ip->dev, addr);
+      m = min(n - tot, BSIZE - off%BSIZE);
+      r = either_copyout(user_dst, dst, bp->data + (off % BSIZE), m);
       brelse(bp);
+    }
+    if(r == -1) {
       tot = -1;
       break;
     }
-    brelse(bp);
   }
   return tot;
 }
@@ -504,11 +711,16 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
 // there was an error of some kind.
+// Regular files are written into the page cache, which
+// writes them back later, and are logged only if no
+// page can be had.
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
+  uint64 pa;
   struct buf *bp;
+  int r;
 
   if(off > ip->size || off + n < off)
     return -1;
@@ -519,12 +731,34 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
-    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(ip->type == T_FILE && (pa = pageget(ip, off/PGSIZE)) != 0){
+      r = either_copyin((char*)pa + (off % PGSIZE), user_src, src, m);
+      // a block the file grows into must reach the disk
+      // before the new size does.
+      if(pcache_dirty(ip, off/PGSIZE, pa, (off % PGSIZE) / BSIZE, addr,
+                      r != -1 && off + m > ip->size) < 0 && r != -1){
+        // not cached after all: log it as below.
+        bp = bread(ip->dev, addr);
+        memmove(bp->data + (off % BSIZE), (char*)pa + (off % PGSIZE), m);
+        log_write(bp);
+        brelse(bp);
+      }
+      pcache_put(pa);
+      if(r == -1)
+        break;
+      continue;
+    }
+    // a whole-block overwrite need not read the old contents.
+    if(m == BSIZE)
+      bp = bfresh(ip->dev, addr);
+    else
+      bp = bread(ip->dev, addr);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
+    bp->valid = 1;
     log_write(bp);
     brelse(bp);
   }
@@ -658,24 +892,26 @@ namex(char *path, int nameiparent, char *name)
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
   else
-    ip = idup(myproc()->cwd);
+    ip = cwdget();
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    // lookups only read directories, so they can share them.
+    ilockshared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlockshared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlockshared(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+    next = dirlookup(ip, name, 0);
+    iunlockshared(ip);
+    iput(ip);
+    if(next == 0)
       return 0;
-    }
-    iunlockput(ip);
     ip = next;
   }
   if(nameiparent){
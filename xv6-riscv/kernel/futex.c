@@ -0,0 +1,98 @@
+// Futexes: blocking on a word of user memory.
+//
+// futex_wait(addr, val) sleeps if the int at addr still holds
+// val; futex_wake(addr, n) wakes up to n of the threads sleeping
+// on addr. User code does the fast path with atomic instructions
+// and calls into the kernel only when it has to wait or when
+// someone may be waiting (see the mutex in user/ulib.c).
+//
+// A futex is named by the physical address of its word, so two
+// processes that map the same page agree on it. Waiters sleep in
+// the ordinary wait queues with that address as the channel.
+// A waiter pins its page, so swap_out() cannot move the word to
+// another address while anyone sleeps on it.
+//
+// A lock per hash bucket makes checking the word and going to
+// sleep atomic with respect to futex_wake().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEXLOCK 31
+#define FUTEXLOCK(pa) (&futexlock[((pa) >> 2) % NFUTEXLOCK])
+
+struct spinlock futexlock[NFUTEXLOCK];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXLOCK; i++)
+    initlock(&futexlock[i], "futex");
+}
+
+// Sleep until woken by futex_wake(), if the int at user
+// address addr holds val.
+// Returns 0 after sleeping, or -1 if the int did not hold
+// val or addr is not a writable, aligned user address.
+int
+futex_wait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+  int r = -1;
+
+  if(addr % sizeof(int) != 0)
+    return -1;
+  vmlock();
+  pa = uvmpin(p->pagetable, addr);
+  vmunlock();
+  if(pa == 0)
+    return -1;
+
+  lk = FUTEXLOCK(pa);
+  acquire(lk);
+  if(__atomic_load_n((int*)pa, __ATOMIC_SEQ_CST) == val && !killed(p)){
+    sleep((void*)pa, lk);
+    r = 0;
+  }
+  release(lk);
+
+  kfree((void*)PGROUNDDOWN(pa));
+  return r;
+}
+
+// Wake at most n threads sleeping on the int at user
+// address addr, longest waiting first.
+// Returns the number woken, or -1 if addr is bad.
+int
+futex_wake(uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0 || n < 0)
+    return -1;
+  vmlock();
+  pa = uvmpin(p->pagetable, addr);
+  vmunlock();
+  if(pa == 0)
+    return -1;
+
+  lk = FUTEXLOCK(pa);
+  acquire(lk);
+  n = wakeupn((void*)pa, n);
+  release(lk);
+
+  kfree((void*)PGROUNDDOWN(pa));
+  return n;
+}
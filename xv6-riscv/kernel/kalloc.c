@@ -1,12 +1,13 @@
 // Physical memory allocator, for user processes,
-// kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// kernel stacks, page-table pages, pipe buffers
+// and slabs. Allocates whole 4096-byte pages.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "trace.h"
 #include "defs.h"
 
 void freerange(void *pa_start, void *pa_end);
@@ -31,6 +32,9 @@ struct {
 struct spinlock lru_lock;
 struct page pages[PHYSTOP/PGSIZE]; // Physical Page Metadata Arrangement
 struct page *lru_head = 0;         // LRU List Head
+int lru_npages;                    // number of pages on the LRU list
+struct page *file_lru_head = 0;    // page cache pages, least recent first
+int file_npages;
 
 // Bitmap for Swap Space management (simple array implementation)
 // 4 blocks per page
@@ -45,6 +49,9 @@ kinit()
   // PA4: Initialize LRU list and Swap lock
   lru_init();
   freerange(end, (void*)PHYSTOP);
+  // wait channels in allocated memory outside the slab
+  // caches that name their own.
+  addwchan("heap", end, PHYSTOP - (uint64)end);
 }
 
 void
@@ -52,22 +59,37 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    pages[(uint64)p / PGSIZE].refcnt = 1;
     kfree(p);
+  }
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// A page lent to a pipe (see uvmloan) has more than one
+// reference; it is only freed once the last one is dropped.
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct page *p;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  p = &pages[(uint64)pa / PGSIZE];
+  acquire(&lru_lock);
+  if(p->refcnt < 1)
+    panic("kfree: refcnt");
+  if(--p->refcnt > 0){
+    release(&lru_lock);
+    return;
+  }
+  release(&lru_lock);
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
@@ -86,31 +108,62 @@ lru_init()
   initlock(&lru_lock, "lru");
   initlock(&swap_lock, "swap");
   lru_head = 0;
+  lru_npages = 0;
+  file_lru_head = 0;
+  file_npages = 0;
   // initializing swap_bitmap
   memset(swap_bitmap, 0, sizeof(swap_bitmap));
 }
 
-// Add a page to the LRU list (call in kalloc or maps)
-void
-lru_add(uint64 pa)
+// Insert p at the tail (most recently used end) of the
+// circular list at *head. Caller holds lru_lock.
+static void
+list_insert(struct page **head, struct page *p)
 {
-  struct page *p = &pages[pa / PGSIZE]; // Import page structures for that physical address
-  acquire(&lru_lock);
-  if(lru_head == 0) {
+  if(*head == 0) {
     // If the list is empty, point to myself to create a circular list
-    lru_head = p;
+    *head = p;
     p->next = p;
     p->prev = p;
   } else {
     // Insert in front of the head of the list (considered the most recent used)
-    struct page *tail = lru_head->prev;
+    struct page *tail = (*head)->prev;
 
-    p->next = lru_head;
+    p->next = *head;
     p->prev = tail;
     
     tail->next = p;
-    lru_head->prev = p;
+    (*head)->prev = p;
+  }
+}
+
+// Unlink p from the circular list at *head.
+// Caller holds lru_lock.
+static void
+list_unlink(struct page **head, struct page *p)
+{
+  if(p->next == p) { // When there is only one in the list
+      *head = 0;
+  } else {
+      // Disconnect link
+      p->prev->next = p->next;
+      p->next->prev = p->prev;
+      // If the node being removed was head, move the head to the next node
+      if(*head == p) *head = p->next;
   }
+  // Hang up the link for safety
+  p->next = 0;
+  p->prev = 0;
+}
+
+// Add a page to the LRU list (call in kalloc or maps)
+void
+lru_add(uint64 pa)
+{
+  struct page *p = &pages[pa / PGSIZE]; // Import page structures for that physical address
+  acquire(&lru_lock);
+  list_insert(&lru_head, p);
+  lru_npages++;
   release(&lru_lock);
 }
 
@@ -127,19 +180,71 @@ lru_remove(uint64 pa)
     return;
   }
 
-  if(p->next == p) { // When there is only one in the list
-      lru_head = 0;
-  } else {
-      // Disconnect link
-      p->prev->next = p->next;
-      p->next->prev = p->prev;
-      // If the node being removed was head, move the head to the next node
-      if(lru_head == p) lru_head = p->next;
+  list_unlink(&lru_head, p);
+  lru_npages--;
+  release(&lru_lock);
+}
+
+// Add a page cache page to the file LRU list, taking
+// the cache's reference to it.
+void
+file_lru_add(uint64 pa)
+{
+  struct page *p = &pages[pa / PGSIZE];
+  acquire(&lru_lock);
+  p->refcnt++;
+  list_insert(&file_lru_head, p);
+  file_npages++;
+  release(&lru_lock);
+}
+
+// Remove a page cache page from the file LRU list.
+// The caller then drops the cache's reference with kfree.
+void
+file_lru_remove(uint64 pa)
+{
+  struct page *p = &pages[pa / PGSIZE];
+  acquire(&lru_lock);
+  list_unlink(&file_lru_head, p);
+  file_npages--;
+  release(&lru_lock);
+}
+
+// Pin a page cache page for a reader, who unpins it with
+// kfree, and mark it most recently used.
+void
+file_lru_hold(uint64 pa)
+{
+  struct page *p = &pages[pa / PGSIZE];
+  acquire(&lru_lock);
+  p->refcnt++;
+  list_unlink(&file_lru_head, p);
+  list_insert(&file_lru_head, p);
+  release(&lru_lock);
+}
+
+// Take the least recently used page cache page that no
+// reader has pinned off the file LRU list and return it,
+// still holding the cache's reference, or 0 if there is none.
+// Called by pcache_evict, which removes it from its file.
+uint64
+file_lru_evict(void)
+{
+  struct page *p;
+  int i;
+
+  acquire(&lru_lock);
+  p = file_lru_head;
+  for(i = 0; i < file_npages; i++, p = p->next){
+    if(p->refcnt == 1){
+      list_unlink(&file_lru_head, p);
+      file_npages--;
+      release(&lru_lock);
+      return (p - pages) * PGSIZE;
+    }
   }
-  // Hang up the link for safety
-  p->next = 0;
-  p->prev = 0;
   release(&lru_lock);
+  return 0;
 }
 
 // Swap out a victim page to disk and return its physical address
@@ -148,9 +253,10 @@ swap_out(void)
 {
   struct page *p;
   pte_t *pte;
+  pagetable_t pagetable;
   uint64 pa;
   int swap_idx = -1;
-  int i;
+  int i, scanned;
 
   acquire(&lru_lock);
 
@@ -161,8 +267,21 @@ swap_out(void)
   }
 
   // 1. Select a victim page using Clock Algorithm
+  // Two laps clear every PTE_A bit, so give up after that
+  // if every page is pinned.
   p = lru_head;
-  while(1){
+  for(scanned = 0; ; scanned++){
+    if(scanned > 2 * lru_npages){
+      release(&lru_lock);
+      return 0;
+    }
+
+    // Skip pages lent to a pipe; the borrower still reads them.
+    if(p->refcnt > 1){
+      p = p->next;
+      continue;
+    }
+
     pte = walk(p->pagetable, (uint64)p->vaddr, 0);
 
     // Defense code: PTE is not valid (just in case)
@@ -208,6 +327,7 @@ swap_out(void)
   }
   p->next = 0;
   p->prev = 0;
+  lru_npages--;
 
   pa = (p - pages) * PGSIZE;  // Calculate physical addresses with page structure indexes
   
@@ -219,43 +339,72 @@ swap_out(void)
   *pte &= ~PTE_V;
   *pte |= PTE_S;
 
-  // 6. Flush TLB
-  sfence_vma();
+  pagetable = p->pagetable;
 
   // Release lock to allow I/O sleep
   release(&lru_lock);
+
+  // 6. Flush TLB, on every CPU running a thread that
+  // shares the page table, before the page is written out
+  tlbflush(pagetable);
   
   // 7. Write page to disk (Safe now, this page is private)
+  trace(TR_SWAPOUT, pa, (uint64)p->vaddr);
   swapwrite(pa, swap_idx, 0); 
 
   // Return the physical address to be reused by kalloc
   return (void*)pa;
 }
 
+// Take a page off the free list, or return 0 if it is empty.
+static struct run*
+freelist_pop(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = kmem.freelist;
+  if(r)
+    kmem.freelist = r->next;
+  release(&kmem.lock);
+  return r;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When memory runs out, take back unused slabs,
+// then drop a file page, then swap a page out.
 // pa4: kalloc function
 void *
 kalloc(void)
 {
   struct run *r;
+  int from = 0;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  r = freelist_pop();
 
+  if(!r && kmem_reap() > 0){
+    r = freelist_pop();
+    from = 1;
+  }
   if(!r) {
-    // If there is no memory, try Swap out
-    r = swap_out();
+    // If there is no memory, drop a clean file page,
+    // and failing that, try Swap out
+    r = pcache_evict();
+    from = 2;
+    if(!r){
+      r = swap_out();
+      from = 3;
+    }
     if(!r) { 
       printf("kalloc: out of memory\n");
       return 0; // Really OOM
     }
   }
+  trace(TR_KALLOC, (uint64)r, from);
 
+  pages[(uint64)r / PGSIZE].refcnt = 1;
   memset((char*)r, 5, PGSIZE);
   return (void*)r;
 }
@@ -0,0 +1,16 @@
+// Lock statistics returned by lockstat(), summed over all
+// spinlocks of the same name. A sleeplock's spinlock has the
+// sleeplock's name, and also counts its waits.
+// Both the kernel and user programs use this header file.
+
+#define NLOCKCLASS 64  // most lock names counted separately
+#define LOCKNAME   16  // significant characters of a lock name
+
+struct lockstat {
+  char name[LOCKNAME];
+  uint64 nacquire;    // acquisitions
+  uint64 ncontended;  // acquisitions that had to wait
+  uint64 spinns;      // nanoseconds spent waiting
+  uint64 nsleepwait;  // sleeplock acquisitions that had to wait
+  uint64 nspinok;     // ... and got the lock by spinning, not sleeping
+};
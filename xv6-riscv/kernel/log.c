@@ -17,9 +17,12 @@
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// the count of in-progress FS system calls and reserves
+// MAXOPBLOCKS of log space. But if it thinks the log is
+// close to running out, it sleeps until the last
+// outstanding end_op() commits. A call that knows it will
+// write more (or fewer) blocks, like a large write(), uses
+// begin_opn(n)/end_opn(n) to reserve exactly n blocks.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -42,6 +45,7 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by outstanding calls.
   int committing;  // in commit(), please wait.
   int dev;
   struct logheader lh;
@@ -58,6 +62,7 @@ initlog(int dev, struct superblock *sb)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+  addwchan("log", &log, sizeof(log));
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
@@ -122,34 +127,41 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that
+// may write up to nblocks distinct blocks.
 void
-begin_op(void)
+begin_opn(int nblocks)
 {
+  if(nblocks < 1 || nblocks > LOGSIZE)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + nblocks > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += nblocks;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
+// called at the end of each FS system call that began
+// with begin_opn(nblocks).
 // commits if this was the last outstanding operation.
 void
-end_op(void)
+end_opn(int nblocks)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= nblocks;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
@@ -157,7 +169,7 @@ end_op(void)
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
@@ -174,6 +186,20 @@ end_op(void)
   }
 }
 
+// called at the start of each FS system call.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
 // Copy modified blocks from cache to log.
 static void
 write_log(void)
@@ -193,6 +219,8 @@ write_log(void)
 static void
 commit()
 {
+  // file blocks the transaction allocated go to disk first.
+  pcache_commit();
   if (log.lh.n > 0) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
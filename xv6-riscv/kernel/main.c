@@ -19,14 +19,22 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    slabinit();      // kernel object allocator
     procinit();      // process table
+    futexinit();     // user wait queues
+    profinit();      // sampling profiler
+    traceinit();     // event tracing
+    ringinit();      // system call rings
     trapinit();      // trap vectors
+    vdatainit();     // user-readable kernel data page
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    pcacheinit();    // file page cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipes
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
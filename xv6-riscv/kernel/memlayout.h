@@ -25,6 +25,11 @@
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
 
+// core local interruptor (CLINT); the kernel only uses
+// its machine software interrupt bits, to send IPIs.
+#define CLINT 0x2000000L
+#define CLINT_MSIP(hart) (CLINT + 4*(hart))
+
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -54,6 +59,12 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   VDATA (the kernel's read-only data page)
+//   RING (the system call ring, if set up)
+//   trapframes of the process's other threads
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(i) (TRAPFRAME - (i)*PGSIZE)
+#define RING (THREADFRAME(NTHREAD-1) - PGSIZE)
+#define VDATA (RING - PGSIZE)
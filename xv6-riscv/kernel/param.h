@@ -1,14 +1,30 @@
-#define NPROC        64  // maximum number of processes
+// The process, file and inode tables grow on demand up to these
+// limits, which the Makefile lets you override.
+#ifndef NPROC
+#define NPROC       512  // maximum number of processes
+#endif
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NTHREAD      16  // maximum threads per process
+#define NPRIO         4  // scheduler priority levels
+#define BOOSTTICKS   50  // ticks between scheduler priority boosts
+#define HZ           10  // clock ticks per second
+#define TIMEBASE 10000000  // rate of the time CSR (qemu virt)
+#define NOFILE       16  // initial size of a process's file table
+#ifndef MAXOFILE
+#define MAXOFILE    512  // open files per process, at most PGSIZE/8
+#endif
+#ifndef NFILE
+#define NFILE      2048  // open files per system
+#endif
+#ifndef NINODE
+#define NINODE      200  // maximum number of in-memory i-nodes
+#endif
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*6)  // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*9)  // size of disk block cache
 #define FSSIZE       30000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
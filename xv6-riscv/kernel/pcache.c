@@ -0,0 +1,403 @@
+// Page cache.
+//
+// Holds the contents of regular files in whole 4096-byte pages,
+// separately from the block buffer cache, which keeps metadata,
+// log and swap blocks. Each inode indexes its cached pages with
+// a small radix tree rooted at ip->pcroot.
+//
+// The cache is write-back. writei() copies new bytes of a regular
+// file into its cached page and marks the block dirty instead of
+// logging it; the page stays pinned until the block is written to
+// its home location on disk. That happens:
+// * at commit, for a block the write allocated or grew the file
+//   into: pcache_commit() writes it before the log records the
+//   new size and block pointers, so a crash never leaves the file
+//   longer than the data that reached the disk;
+// * when the last reference to the inode goes, in iput();
+// * when sync() is called, as the update process started by
+//   init does every few seconds.
+// Truncating a file discards its dirty pages unwritten.
+//
+// Cached pages sit on the file LRU list in kalloc.c. When memory
+// runs out, kalloc() evicts the least recently used unpinned file
+// page before it swaps out anonymous memory. Dirty pages are
+// pinned, so eviction never has to write.
+//
+// Interface:
+// * pcache_lookup() returns a pinned page, or 0 on a miss.
+// * pcache_insert() adds a page the caller has filled.
+// * pcache_put() unpins a page.
+// * pcache_dirty() marks a block of a cached page written.
+// * pcache_flush() writes an inode's dirty blocks to disk.
+// * pcache_commit() writes the blocks a commit depends on.
+// * pcache_drop() discards all of an inode's pages.
+//
+// The caller holds ip->lock for pcache_lookup(), pcache_insert(),
+// pcache_dirty() and pcache_flush(). pcache_drop() is called when
+// nothing else can be using the inode.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "file.h"
+
+#define PCBITS   4
+#define PCFAN    (1 << PCBITS)
+#define PCLEVELS 2   // PCFAN^PCLEVELS pages covers MAXFILE
+#define PCINDEX(pgno, level) (((pgno) >> ((level)*PCBITS)) & (PCFAN-1))
+#define NPCNODE  512
+#define NPCBLOCK (PGSIZE/BSIZE)
+
+// An interior node holds child nodes; a level-0 node holds
+// the physical addresses of cached pages.
+struct pcnode {
+  void *slot[PCFAN];
+  int n;               // non-empty slots
+  struct pcnode *next; // free list
+};
+
+// A block that must be on disk before the running
+// transaction commits. Holds a pin on its page.
+struct ordered {
+  uint64 pa;
+  int blk;             // block within the page
+  uint dev;
+  uint addr;
+};
+
+struct {
+  struct spinlock lock;
+  struct pcnode node[NPCNODE];
+  struct pcnode *free;
+  // every ordered block was reserved as a data block by
+  // begin_opn(), so a transaction has no more than LOGSIZE.
+  struct ordered ordered[LOGSIZE];
+  int nordered;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  struct pcnode *nd;
+
+  if((uint64)PGSIZE << (PCBITS*PCLEVELS) < MAXFILE*BSIZE)
+    panic("pcacheinit: tree too shallow");
+
+  initlock(&pcache.lock, "pcache");
+  for(nd = pcache.node; nd < pcache.node+NPCNODE; nd++){
+    nd->next = pcache.free;
+    pcache.free = nd;
+  }
+}
+
+static struct pcnode*
+pcnalloc(void)
+{
+  struct pcnode *nd;
+
+  if((nd = pcache.free) == 0)
+    return 0;
+  pcache.free = nd->next;
+  memset(nd, 0, sizeof(*nd));
+  return nd;
+}
+
+static void
+pcnfree(struct pcnode *nd)
+{
+  nd->next = pcache.free;
+  pcache.free = nd;
+}
+
+// Return the level-0 node holding the slot for page pgno
+// of ip, creating nodes on the way if alloc is set.
+// Returns 0 if there is no such node or no free node.
+static struct pcnode*
+pcwalk(struct inode *ip, uint pgno, int alloc)
+{
+  struct pcnode **np = &ip->pcroot;
+  struct pcnode *parent = 0;
+  int level;
+
+  for(level = PCLEVELS-1; ; level--){
+    if(*np == 0){
+      if(!alloc || (*np = pcnalloc()) == 0)
+        return 0;
+      if(parent)
+        parent->n++;
+    }
+    if(level == 0)
+      return *np;
+    parent = *np;
+    np = (struct pcnode**)&parent->slot[PCINDEX(pgno, level)];
+  }
+}
+
+// Clear the slot for page pgno of ip, which must be set,
+// and free the nodes that become empty.
+static void
+pcremove(struct inode *ip, uint pgno)
+{
+  struct pcnode **path[PCLEVELS];
+  struct pcnode **np = &ip->pcroot;
+  int level;
+
+  for(level = PCLEVELS-1; level >= 0; level--){
+    path[level] = np;
+    if(level > 0)
+      np = (struct pcnode**)&(*np)->slot[PCINDEX(pgno, level)];
+  }
+  for(level = 0; level < PCLEVELS; level++){
+    np = path[level];
+    (*np)->slot[PCINDEX(pgno, level)] = 0;
+    if(--(*np)->n > 0)
+      break;
+    pcnfree(*np);
+    *np = 0;
+  }
+}
+
+// Forget the ordered blocks of page pa, dropping their pins.
+static void
+unorder(uint64 pa)
+{
+  int i;
+
+  for(i = 0; i < pcache.nordered; ){
+    if(pcache.ordered[i].pa == pa){
+      pcache.ordered[i] = pcache.ordered[--pcache.nordered];
+      kfree((void*)pa);
+    } else {
+      i++;
+    }
+  }
+}
+
+// Free a subtree and drop the cache's reference to its
+// pages, discarding their dirty blocks.
+static void
+pcfree(struct inode *ip, struct pcnode *nd, int level)
+{
+  struct page *p;
+  int i;
+
+  for(i = 0; i < PCFAN; i++){
+    if(nd->slot[i] == 0)
+      continue;
+    if(level > 0){
+      pcfree(ip, nd->slot[i], level-1);
+    } else {
+      p = &pages[(uint64)nd->slot[i] / PGSIZE];
+      unorder((uint64)nd->slot[i]);
+      if(p->dirty){
+        p->dirty = 0;
+        ip->ndirty--;
+        kfree(nd->slot[i]);
+      }
+      file_lru_remove((uint64)nd->slot[i]);
+      kfree(nd->slot[i]);
+    }
+  }
+  pcnfree(nd);
+}
+
+// Return the cached page pgno of ip, pinned so that it
+// cannot be evicted, or 0 if it is not cached.
+uint64
+pcache_lookup(struct inode *ip, uint pgno)
+{
+  struct pcnode *nd;
+  uint64 pa = 0;
+
+  acquire(&pcache.lock);
+  nd = pcwalk(ip, pgno, 0);
+  if(nd && nd->slot[PCINDEX(pgno, 0)]){
+    pa = (uint64)nd->slot[PCINDEX(pgno, 0)];
+    file_lru_hold(pa);
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Add pa, a kalloc()ed page holding page pgno of ip, to
+// the cache. The caller's reference becomes a pin, to be
+// dropped with pcache_put(). If the cache has no room the
+// page is simply not cached.
+void
+pcache_insert(struct inode *ip, uint pgno, uint64 pa)
+{
+  struct pcnode *nd;
+  struct page *p;
+
+  acquire(&pcache.lock);
+  nd = pcwalk(ip, pgno, 1);
+  if(nd && nd->slot[PCINDEX(pgno, 0)] == 0){
+    nd->slot[PCINDEX(pgno, 0)] = (void*)pa;
+    nd->n++;
+    p = &pages[pa / PGSIZE];
+    p->ip = ip;
+    p->pgno = pgno;
+    file_lru_add(pa);
+  }
+  release(&pcache.lock);
+}
+
+// Unpin a page returned by pcache_lookup() or inserted
+// with pcache_insert().
+void
+pcache_put(uint64 pa)
+{
+  kfree((void*)pa);
+}
+
+// Note that the caller has written into block blk of page
+// pgno of ip, held at pa, and that the block belongs at disk
+// address addr. If ordered is set, the block must be on disk
+// before the running transaction commits.
+// Returns -1 if pa is not in the cache, so that the caller
+// must write the block itself.
+int
+pcache_dirty(struct inode *ip, uint pgno, uint64 pa, int blk, uint addr, int ordered)
+{
+  struct pcnode *nd;
+  struct page *p = &pages[pa / PGSIZE];
+  struct ordered *o;
+
+  acquire(&pcache.lock);
+  nd = pcwalk(ip, pgno, 0);
+  if(nd == 0 || nd->slot[PCINDEX(pgno, 0)] != (void*)pa){
+    release(&pcache.lock);
+    return -1;
+  }
+  if(p->dirty == 0){
+    // the dirty page keeps a pin until it is written.
+    file_lru_hold(pa);
+    ip->ndirty++;
+  }
+  p->dirty |= 1 << blk;
+  p->blkaddr[blk] = addr;
+  if(ordered){
+    for(o = pcache.ordered; o < pcache.ordered + pcache.nordered; o++)
+      if(o->pa == pa && o->blk == blk)
+        break;
+    if(o == pcache.ordered + pcache.nordered){
+      if(pcache.nordered == LOGSIZE)
+        panic("pcache_dirty: too many ordered blocks");
+      o->pa = pa;
+      o->blk = blk;
+      o->dev = ip->dev;
+      o->addr = addr;
+      pcache.nordered++;
+      file_lru_hold(pa);
+    }
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Write BSIZE bytes at data to disk block addr.
+static void
+writeblock(uint dev, uint addr, char *data)
+{
+  struct buf *bp;
+
+  bp = bfresh(dev, addr);
+  memmove(bp->data, data, BSIZE);
+  bp->valid = 1;
+  bwrite(bp);
+  brelse(bp);
+}
+
+// Write all dirty blocks of ip to disk.
+// Caller holds ip->lock, perhaps shared, so that nothing
+// writes or truncates the file meanwhile.
+void
+pcache_flush(struct inode *ip)
+{
+  struct pcnode *nd;
+  struct page *p;
+  uint pgno, addr[NPCBLOCK];
+  uint64 pa;
+  int i, dirty;
+
+  // a write that failed may have left a dirty page past
+  // EOF, in a block it allocated; write that too.
+  for(pgno = 0; pgno*PGSIZE < MAXFILE*BSIZE && ip->ndirty > 0; pgno++){
+    acquire(&pcache.lock);
+    nd = pcwalk(ip, pgno, 0);
+    if(nd == 0 || (pa = (uint64)nd->slot[PCINDEX(pgno, 0)]) == 0 ||
+       pages[pa / PGSIZE].dirty == 0){
+      release(&pcache.lock);
+      continue;
+    }
+    // take the blocks to write, and the dirty page's pin.
+    p = &pages[pa / PGSIZE];
+    dirty = p->dirty;
+    for(i = 0; i < NPCBLOCK; i++)
+      addr[i] = p->blkaddr[i];
+    p->dirty = 0;
+    ip->ndirty--;
+    release(&pcache.lock);
+
+    for(i = 0; i < NPCBLOCK; i++)
+      if(dirty & (1 << i))
+        writeblock(ip->dev, addr[i], (char*)pa + i*BSIZE);
+    kfree((void*)pa);
+  }
+}
+
+// Write the ordered blocks to disk. Called by the log
+// before it commits the running transaction.
+void
+pcache_commit(void)
+{
+  struct ordered o;
+
+  for(;;){
+    acquire(&pcache.lock);
+    if(pcache.nordered == 0){
+      release(&pcache.lock);
+      break;
+    }
+    o = pcache.ordered[--pcache.nordered];
+    release(&pcache.lock);
+    writeblock(o.dev, o.addr, (char*)o.pa + o.blk*BSIZE);
+    kfree((void*)o.pa);
+  }
+}
+
+// Discard all cached pages of ip.
+void
+pcache_drop(struct inode *ip)
+{
+  acquire(&pcache.lock);
+  if(ip->pcroot){
+    pcfree(ip, ip->pcroot, PCLEVELS-1);
+    ip->pcroot = 0;
+  }
+  release(&pcache.lock);
+}
+
+// Evict the least recently used unpinned page from the cache
+// and return it for reuse, or 0 if there is none.
+// Called by kalloc() when memory runs out.
+void*
+pcache_evict(void)
+{
+  struct page *p;
+  uint64 pa;
+
+  acquire(&pcache.lock);
+  if((pa = file_lru_evict()) != 0){
+    p = &pages[pa / PGSIZE];
+    pcremove(p->ip, p->pgno);
+    p->ip = 0;
+  }
+  release(&pcache.lock);
+  return (void*)pa;
+}
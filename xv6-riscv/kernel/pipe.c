@@ -3,22 +3,51 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define PIPESIZE PGSIZE          // ring buffer is one full page
+#define PIPEWAKE (PIPESIZE / 2)  // free space that wakes a blocked writer
+#define PIPELOANS 16             // pages a writer may lend at once
+
+// A user page lent to the pipe by a page-aligned write,
+// read straight out of the writer's memory (see uvmloan).
+struct pipeloan {
+  uint64 pa;      // physical page, holding a reference
+  uint off;       // next byte to read
+};
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data;     // PIPESIZE-byte ring buffer page
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int nrwait;     // readers sleeping in piperead()
+  int nwwait;     // writers sleeping in pipewrite()
+
+  // Lent pages come after everything in the ring: they are only
+  // queued while the ring is empty, and the ring is only written
+  // once they have all been read.
+  struct pipeloan loan[PIPELOANS];
+  uint lhead;     // next loan to read
+  uint ltail;     // next free loan slot
 };
 
+struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe));
+  addwchancache("pipe", pipecache);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +57,18 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(pipecache)) == 0)
+    goto bad;
+  if((pi->data = kalloc()) == 0)
     goto bad;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->nrwait = 0;
+  pi->nwwait = 0;
+  pi->lhead = 0;
+  pi->ltail = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +82,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    kmem_cache_free(pipecache, pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +103,27 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    for(; pi->lhead != pi->ltail; pi->lhead++)
+      kfree((void*)pi->loan[pi->lhead % PIPELOANS].pa);
+    kfree(pi->data);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Copy user data into the ring a contiguous segment at a time,
+// so each copyin() covers as many bytes as the ring can take
+// before it wraps, rather than a single byte.
+// Whole, page-aligned user pages are lent to the pipe instead
+// of copied, so the reader copies them straight from the writer.
+// If user_src==1, addr is a user virtual address;
+// otherwise, addr is a kernel address.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n)
 {
   int i = 0;
+  uint off, m;
+  uint64 pa;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,46 +132,85 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    if(user_src && n - i >= PGSIZE && (addr + i) % PGSIZE == 0 &&
+       pi->nwrite == pi->nread && pi->ltail - pi->lhead < PIPELOANS &&
+       uvmloan(pr->pagetable, addr + i, &pa) == 0){
+      pi->loan[pi->ltail % PIPELOANS].pa = pa;
+      pi->loan[pi->ltail % PIPELOANS].off = 0;
+      pi->ltail++;
+      i += PGSIZE;
+      continue;
+    }
+    if(pi->lhead != pi->ltail || pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+      if(pi->nrwait)
+        wakeup(&pi->nread);
+      pi->nwwait++;
       sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwwait--;
+      continue;
     }
+    off = pi->nwrite % PIPESIZE;
+    m = min(n - i, PIPESIZE - (pi->nwrite - pi->nread));
+    m = min(m, PIPESIZE - off);
+    if(either_copyin(pi->data + off, user_src, addr + i, m) == -1)
+      break;
+    pi->nwrite += m;
+    i += m;
   }
-  wakeup(&pi->nread);
+  // readers only sleep on an empty pipe, so any data wakes them.
+  if(pi->nrwait)
+    wakeup(&pi->nread);
   release(&pi->lock);
 
   return i;
 }
 
+// If user_dst==1, addr is a user virtual address;
+// otherwise, addr is a kernel address.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n)
 {
   int i;
+  uint off, m;
+  struct pipeloan *l;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while(pi->nread == pi->nwrite && pi->lhead == pi->ltail &&
+        pi->writeopen){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
+    pi->nrwait++;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
+    pi->nrwait--;
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
+    if(pi->lhead != pi->ltail){
+      l = &pi->loan[pi->lhead % PIPELOANS];
+      m = min(n - i, PGSIZE - l->off);
+      if(either_copyout(user_dst, addr + i, (char*)l->pa + l->off, m) == -1)
+        break;
+      if((l->off += m) == PGSIZE){
+        kfree((void*)l->pa);
+        pi->lhead++;
+      }
+    } else if(pi->nread != pi->nwrite){
+      off = pi->nread % PIPESIZE;
+      m = min(n - i, pi->nwrite - pi->nread);
+      m = min(m, PIPESIZE - off);
+      if(either_copyout(user_dst, addr + i, pi->data + off, m) == -1)
+        break;
+      pi->nread += m;
+    } else
       break;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  // only wake writers once there is room for a bulk write,
+  // instead of after every byte that frees up.
+  if(pi->nwwait && pi->ltail - pi->lhead <= PIPELOANS / 2 &&
+     PIPESIZE - (pi->nwrite - pi->nread) >= PIPEWAKE)
+    wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
@@ -3,22 +3,98 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rwlock.h"
 #include "proc.h"
+#include "trace.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// Proc structs are allocated on demand, up to NPROC of them,
+// and never freed: an exited process's struct, with its
+// kernel stack, goes on procfree for reuse.
+struct kmem_cache *proccache;
+
+struct kmem_cache *tgcache;
 
 struct proc *initproc;
 
+// Multi-level feedback queue scheduling. A process starts
+// at level p->nice and may use SLICE(level) ticks there before
+// it drops a level; sleeping does not reset the count. Every
+// BOOSTTICKS ticks all processes return to their nice level,
+// so CPU-bound processes at the bottom cannot starve.
+#define SLICE(prio) (1 << (prio))
+
+int boostepoch;  // count of priority boosts so far
+
+// Per-CPU run queues of RUNNABLE processes, one FIFO list
+// per priority level, linked through p->rqnext. A process
+// is on at most one queue, and on one exactly when it is
+// RUNNABLE and not yet picked.
+// Lock order: p->lock, then a run queue's lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+  int n;         // processes on all levels
+  int epoch;     // last boost applied to the lists
+} runq[NCPU];
+
+// Sleeping processes, hashed by wait channel into lists
+// linked through p->wqnext, so that wakeup() looks only at
+// processes that might be sleeping on its channel.
+// Lock order: a wait queue's lock, then p->lock.
+#define NWAITQ 61
+#define WAITQ(chan) (&waitq[((uint64)(chan) >> 3) % NWAITQ])
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+// Wakeup counters by channel class, shown by procdump().
+// Subsystems name the memory their channels live in with
+// addwchan(), or the slab cache of the objects holding them
+// with addwchancache(); everything else counts as "other".
+#define NWCLASS 16
+
+struct wchanclass {
+  char *name;
+  struct kmem_cache *cache;  // or 0, and the class is [start, end)
+  uint64 start;
+  uint64 end;
+  uint64 wakeups;  // wakeup() calls on the class's channels
+  uint64 woken;    // processes those calls woke
+} wchanclass[NWCLASS] = { { "other" } };
+int nwchanclass = 1;
+
 int nextpid = 1;
-struct spinlock pid_lock;
+struct rwlock pid_lock;
+
+// Live processes hashed by pid, chained through p->pidnext,
+// under pid_lock. Lookups, as by kill(), only read it.
+#define NPIDHASH 64
+struct proc *pidhash[NPIDHASH];
+
+// UNUSED procs, linked through p->nextfree, and all procs,
+// linked through p->allnext.
+// Lock order: p->lock, then procfree.lock.
+struct {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *all;
+  int n;            // procs allocated; the i'th has stack KSTACK(i)
+} procfree;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static int fdgrow(struct tgroup *tg, int n);
+static int reap(int thread, int pid, uint64 addr);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable;
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -26,36 +102,32 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
+// Each process's kernel stack is mapped high in memory,
+// followed by an invalid guard page, when its proc is first
+// allocated. Create the page-table pages for all the stacks
+// now, so that mapping one later never allocates.
 void
 proc_mapstacks(pagetable_t kpgtbl)
 {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-  }
+  for(int i = 0; i < NPROC; i++)
+    if(walk(kpgtbl, KSTACK(i), 1) == 0)
+      panic("proc_mapstacks");
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
-  initlock(&pid_lock, "nextpid");
+  initrwlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  initlock(&procfree.lock, "procfree");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+  proccache = kmem_cache_create("proc", sizeof(struct proc));
+  tgcache = kmem_cache_create("tgroup", sizeof(struct tgroup));
+  addwchancache("proc", proccache);
 }
 
 // Must be called with interrupts disabled,
@@ -89,41 +161,366 @@ myproc(void)
   return p;
 }
 
-int
-allocpid()
+// Apply any priority boost p has missed.
+// Caller must hold p->lock.
+static void
+catchboost(struct proc *p)
 {
-  int pid;
-  
-  acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
-  release(&pid_lock);
+  if(p->epoch != boostepoch){
+    p->epoch = boostepoch;
+    p->prio = p->nice;
+    p->used = 0;
+  }
+}
 
-  return pid;
+// Append p to rq's list for level prio.
+// Caller must hold rq->lock.
+static void
+runq_append(struct runq *rq, struct proc *p, int prio)
+{
+  p->rqnext = 0;
+  if(rq->tail[prio])
+    rq->tail[prio]->rqnext = p;
+  else
+    rq->head[prio] = p;
+  rq->tail[prio] = p;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// Mark p RUNNABLE and append it to a run queue: the queue
+// of the CPU p last ran on, for cache affinity, unless that
+// queue is well behind this CPU's, in which case this one.
+// An idle CPU sleeps in wfi without a clock, so send it an
+// IPI: the target CPU if it is idle, else any idle CPU,
+// which will steal p, unless this CPU is idle itself.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+  int i, id = cpuid();
+
+  p->state = RUNNABLE;
+  catchboost(p);
+  if(!cpus[p->cpu].idle && runq[p->cpu].n > runq[id].n + 1)
+    p->cpu = id;
+  rq = &runq[p->cpu];
+
+  acquire(&rq->lock);
+  runq_append(rq, p, p->prio);
+  rq->n++;
+  release(&rq->lock);
+
+  // pairs with the barrier between setting c->idle and
+  // looking at the run queues in scheduler().
+  __sync_synchronize();
+  if(cpus[p->cpu].idle){
+    if(p->cpu != id)
+      sendipi(p->cpu);
+  } else if(!cpus[id].idle){
+    for(i = 0; i < NCPU; i++){
+      if(i != id && cpus[i].idle){
+        sendipi(i);
+        break;
+      }
+    }
+  }
+}
+
+// Remove and return the highest-priority process on rq,
+// or 0 if rq is empty. Moves queued processes back to
+// their nice level first if a boost is due.
+static struct proc*
+runq_pop(struct runq *rq)
+{
+  struct proc *p, *list[NPRIO];
+  int i;
+
+  if(rq->n == 0)
+    return 0;   // racy peek; avoids the lock for idle queues
+  acquire(&rq->lock);
+  if(rq->epoch != boostepoch){
+    rq->epoch = boostepoch;
+    for(i = 0; i < NPRIO; i++){
+      list[i] = rq->head[i];
+      rq->head[i] = rq->tail[i] = 0;
+    }
+    // p->nice is read without p->lock; the scheduler
+    // sets the level properly once it has the lock.
+    for(i = 0; i < NPRIO; i++){
+      while((p = list[i]) != 0){
+        list[i] = p->rqnext;
+        runq_append(rq, p, p->nice);
+      }
+    }
+  }
+  p = 0;
+  for(i = 0; i < NPRIO; i++){
+    if((p = rq->head[i]) != 0){
+      rq->head[i] = p->rqnext;
+      if(rq->head[i] == 0)
+        rq->tail[i] = 0;
+      p->rqnext = 0;
+      rq->n--;
+      break;
+    }
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Pick the next process for CPU id: the best on its own
+// queue, or else one stolen from the longest other queue.
 static struct proc*
-allocproc(void)
+pickproc(int id)
 {
   struct proc *p;
+  int i, busiest, n;
+
+  if((p = runq_pop(&runq[id])) != 0)
+    return p;
+
+  while(1){
+    busiest = -1;
+    n = 0;
+    for(i = 0; i < NCPU; i++){
+      if(i != id && runq[i].n > n){
+        busiest = i;
+        n = runq[i].n;
+      }
+    }
+    if(busiest < 0)
+      return 0;
+    if((p = runq_pop(&runq[busiest])) != 0)
+      return p;
+    // lost a race with its owner; look again.
+  }
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
+// Give p a new pid and enter it in the pid hash.
+static void
+allocpid(struct proc *p)
+{
+  acquirewrite(&pid_lock);
+  p->pid = nextpid;
+  nextpid = nextpid + 1;
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
+  releasewrite(&pid_lock);
+}
+
+// Remove p from the pid hash.
+static void
+freepid(struct proc *p)
+{
+  struct proc **pp;
+
+  acquirewrite(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
     }
   }
+  releasewrite(&pid_lock);
+}
+
+// Return the live process with the given pid, with p->lock
+// held, or 0 if there is none.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  if(pid <= 0)
+    return 0;
+  acquireread(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  releaseread(&pid_lock);
+  if(p == 0)
+    return 0;
+
+  // p may have been freed since we let go of pid_lock.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
+// Make p the newest child of parent.
+// Caller must hold wait_lock.
+static void
+addchild(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  p->prevsib = 0;
+  p->nextsib = parent->children;
+  if(parent->children)
+    parent->children->prevsib = p;
+  parent->children = p;
+}
+
+// Remove p from its parent's list of children.
+// Caller must hold wait_lock.
+static void
+delchild(struct proc *p)
+{
+  if(p->prevsib)
+    p->prevsib->nextsib = p->nextsib;
+  else
+    p->parent->children = p->nextsib;
+  if(p->nextsib)
+    p->nextsib->prevsib = p->prevsib;
+  p->nextsib = p->prevsib = 0;
+  p->parent = 0;
+}
+
+// Allocate a new UNUSED proc and its kernel stack.
+// Returns 0 if there are NPROC procs already,
+// or if there is no memory.
+static struct proc*
+newproc(void)
+{
+  struct proc *p;
+  char *stack;
+
+  if((p = kmem_cache_alloc(proccache)) == 0)
+    return 0;
+  if((stack = kalloc()) == 0){
+    kmem_cache_free(proccache, p);
+    return 0;
+  }
+  initlock(&p->lock, "proc");
+  p->state = UNUSED;
+
+  acquire(&procfree.lock);
+  if(procfree.n == NPROC){
+    release(&procfree.lock);
+    kfree(stack);
+    kmem_cache_free(proccache, p);
+    return 0;
+  }
+  // the page-table page is already there, so this
+  // does not allocate.
+  p->kstack = KSTACK(procfree.n);
+  if(mappages(kernel_pagetable, p->kstack, PGSIZE, (uint64)stack, PTE_R | PTE_W) < 0)
+    panic("newproc");
+  procfree.n++;
+  p->allnext = procfree.all;
+  procfree.all = p;
+  release(&procfree.lock);
+  return p;
+}
+
+// Make p the first thread of a new group, with an empty
+// user page table and file table.
+static int
+tgnew(struct proc *p)
+{
+  struct tgroup *tg;
+
+  if((tg = kmem_cache_alloc(tgcache)) == 0)
+    return -1;
+  initlock(&tg->lock, "tgroup");
+  initsleeplock(&tg->vmlock, "vmlock");
+  tg->nthread = tg->nlive = 1;
+  tg->frames = 1;
+  tg->sz = 0;
+  p->tg = tg;
+  p->tfva = THREADFRAME(0);
+  if(fdgrow(tg, NOFILE) < 0 || (p->pagetable = proc_pagetable(p)) == 0)
+    return -1;
   return 0;
+}
 
-found:
-  p->pid = allocpid();
+// Add p to the current process's group, mapping its
+// trapframe into the shared page table.
+// The caller holds the group's vmlock.
+static int
+tgjoin(struct proc *p)
+{
+  struct tgroup *tg = myproc()->tg;
+  int i;
+
+  acquire(&tg->lock);
+  for(i = 0; i < NTHREAD; i++)
+    if((tg->frames & (1 << i)) == 0)
+      break;
+  if(i == NTHREAD){
+    release(&tg->lock);
+    return -1;
+  }
+  tg->frames |= 1 << i;
+  tg->nthread++;
+  release(&tg->lock);
+
+  p->tg = tg;
+  p->tfva = THREADFRAME(i);
+  p->thread = 1;
+  if(mappages(myproc()->pagetable, p->tfva, PGSIZE,
+              (uint64)p->trapframe, PTE_R | PTE_W) < 0)
+    return -1;
+  p->pagetable = myproc()->pagetable;
+  return 0;
+}
+
+// Take p out of its group, unmapping its trapframe. The last
+// thread to go frees the page table, user memory and group.
+// Must not sleep: freeproc() holds p->lock.
+static void
+tgleave(struct proc *p)
+{
+  struct tgroup *tg = p->tg;
+  int last;
+
+  acquire(&tg->lock);
+  tg->frames &= ~(1 << ((TRAPFRAME - p->tfva) / PGSIZE));
+  last = --tg->nthread == 0;
+  release(&tg->lock);
+
+  if(p->pagetable){
+    if(last)
+      proc_freepagetable(p->pagetable, tg->sz, p->tfva);
+    else
+      uvmunmap(p->pagetable, p->tfva, 1, 0);
+  }
+  if(last){
+    if(tg->ofile)
+      kmfree(tg->ofile);
+    kmem_cache_free(tgcache, tg);
+  }
+  p->tg = 0;
+}
+
+// Take an UNUSED proc off the free list, or allocate a new one.
+// If there is one, initialize state required to run in the kernel,
+// make it a thread of the current process if thread is set, or
+// else give it a new group, and return with p->lock held.
+// If there are no free procs, or a memory allocation fails, return 0.
+static struct proc*
+allocproc(int thread)
+{
+  struct proc *p;
+
+  acquire(&procfree.lock);
+  if((p = procfree.head) != 0)
+    procfree.head = p->nextfree;
+  release(&procfree.lock);
+  if(p == 0 && (p = newproc()) == 0)
+    return 0;
+
+  acquire(&p->lock);
+  if(p->state != UNUSED)
+    panic("allocproc");
+  allocpid(p);
   p->state = USED;
+  p->nice = 0;
+  p->prio = 0;
+  p->used = 0;
+  p->epoch = boostepoch;
 
   // Allocate a trapframe page.
   release(&p->lock); // Unlocking as a swap-out may occur during kalloc
@@ -136,13 +533,12 @@ found:
     return 0;
   }
 
-  // An empty user page table.
+  // Join the current thread group, or make a new one.
   release(&p->lock);
-  pagetable_t pt = proc_pagetable(p);
+  int r = thread ? tgjoin(p) : tgnew(p);
   acquire(&p->lock);
-  
-  p->pagetable = pt;
-  if(p->pagetable == 0){
+
+  if(r < 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -158,18 +554,21 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
+// including user pages, and put it back on the free list.
+// p must no longer be on its parent's list of children.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
 {
+  if(p->tg)
+    tgleave(p);
+  p->pagetable = 0;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
-  p->sz = 0;
+  p->thread = 0;
+  if(p->pid)
+    freepid(p);
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
@@ -177,6 +576,11 @@ freeproc(struct proc *p)
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
+
+  acquire(&procfree.lock);
+  p->nextfree = procfree.head;
+  procfree.head = p;
+  release(&procfree.lock);
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -203,23 +607,33 @@ proc_pagetable(struct proc *p)
 
   // map the trapframe page just below the trampoline page, for
   // trampoline.S.
-  if(mappages(pagetable, TRAPFRAME, PGSIZE,
+  if(mappages(pagetable, p->tfva, PGSIZE,
               (uint64)(p->trapframe), PTE_R | PTE_W) < 0){
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
     uvmfree(pagetable, 0);
     return 0;
   }
 
+  // map the kernel's data page, for user code to read.
+  if(vdatamap(pagetable) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, p->tfva, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
-// Free a process's page table, and free the
-// physical memory it refers to.
+// Free a process's page table, with its trapframe mapped
+// at tfva, and free the physical memory it refers to.
 void
-proc_freepagetable(pagetable_t pagetable, uint64 sz)
+proc_freepagetable(pagetable_t pagetable, uint64 sz, uint64 tfva)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, tfva, 1, 0);
+  uvmunmap(pagetable, VDATA, 1, 0);
+  ringfree(pagetable);
   uvmfree(pagetable, sz);
 }
 
@@ -242,44 +656,71 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy initcode's instructions
   // and data into it.
   uvmfirst(p->pagetable, initcode, sizeof(initcode));
-  p->sz = PGSIZE;
+  p->tg->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
   p->trapframe->epc = 0;      // user program counter
   p->trapframe->sp = PGSIZE;  // user stack pointer
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  p->tg->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  p->cpu = cpuid();
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint64 sz;
+  uint64 sz, oldsz;
   struct proc *p = myproc();
 
-  sz = p->sz;
+  vmlock();
+  sz = oldsz = p->tg->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > VDATA ||
+       (sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+      vmunlock();
       return -1;
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
-  return 0;
+  p->tg->sz = sz;
+  vmunlock();
+  return oldsz;
+}
+
+// Return the number of threads in the current process,
+// counting exited ones that have not been joined.
+int
+threadcount(void)
+{
+  return myproc()->tg->nthread;
+}
+
+// Lock the current process's page table against changes
+// by its other threads.
+void
+vmlock(void)
+{
+  acquiresleep(&myproc()->tg->vmlock);
+}
+
+void
+vmunlock(void)
+{
+  releasesleep(&myproc()->tg->vmlock);
 }
 
 // Create a new process, copying the parent.
@@ -287,27 +728,50 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int i, n, pid;
   struct proc *np;
   struct proc *p = myproc();
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
   release(&np->lock); 
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  vmlock();
+  if(uvmcopy(p->pagetable, np->pagetable, p->tg->sz) < 0){
+    vmunlock();
     acquire(&np->lock); // freeproc requires the lock
     freeproc(np);
     release(&np->lock);
     return -1;
   }
+  np->tg->sz = p->tg->sz;
+  vmunlock();
+
+  // increment reference counts on open file descriptors,
+  // after making the child's file table as big as ours.
+  acquire(&p->tg->lock);
+  while(np->tg->nofile < p->tg->nofile){
+    n = p->tg->nofile;
+    release(&p->tg->lock);
+    if(fdgrow(np->tg, n) < 0){
+      acquire(&np->lock);
+      freeproc(np);
+      release(&np->lock);
+      return -1;
+    }
+    acquire(&p->tg->lock);
+  }
+  for(i = 0; i < p->tg->nofile; i++)
+    if(p->tg->ofile[i])
+      np->tg->ofile[i] = filedup(p->tg->ofile[i]);
+  np->tg->cwd = idup(p->tg->cwd);
+  release(&p->tg->lock);
 
   acquire(&np->lock); // Re-acquire the lock to modify np safely
-  np->sz = p->sz;
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -315,12 +779,6 @@ fork(void)
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
-  np->cwd = idup(p->cwd);
-
   safestrcpy(np->name, p->name, sizeof(p->name));
 
   pid = np->pid;
@@ -328,16 +786,186 @@ fork(void)
   release(&np->lock);
 
   acquire(&wait_lock);
-  np->parent = p;
+  addchild(p, np);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->cpu = cpuid();
+  np->nice = np->prio = p->nice;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Create a thread of the current process, which shares its
+// memory, open files and current directory, and starts by
+// calling fn(arg) on the user stack whose top is at stack.
+// Returns the new thread's pid, or -1.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  struct proc *np, *p = myproc();
+  int tid;
+
+  vmlock();
+  if((np = allocproc(1)) == 0){
+    vmunlock();
+    return -1;
+  }
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack & ~0xf;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = 0;
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  tid = np->pid;
+  release(&np->lock);
+  vmunlock();
+
+  acquire(&p->tg->lock);
+  p->tg->nlive++;
+  release(&p->tg->lock);
+
+  acquire(&wait_lock);
+  addchild(p, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->cpu = cpuid();
+  np->nice = np->prio = p->nice;
+  setrunnable(np);
+  release(&np->lock);
+
+  return tid;
+}
+
+// Grow tg's file table to at least n entries.
+// Return 0, or -1 if n is over MAXOFILE or there is no memory.
+static int
+fdgrow(struct tgroup *tg, int n)
+{
+  struct file **ofile, **old;
+
+  if(n > MAXOFILE)
+    return -1;
+  if((ofile = kmalloc(n * sizeof(struct file*))) == 0)
+    return -1;
+  acquire(&tg->lock);
+  if(n > tg->nofile){
+    if(tg->ofile)
+      memmove(ofile, tg->ofile, tg->nofile * sizeof(struct file*));
+    old = tg->ofile;
+    tg->ofile = ofile;
+    tg->nofile = n;
+    ofile = old;
+  }
+  release(&tg->lock);
+  if(ofile)
+    kmfree(ofile);
+  return 0;
+}
+
+// Allocate a file descriptor for f in the current process,
+// growing its file table if it is full.
+// Takes over file reference from caller on success.
+int
+fdalloc(struct file *f)
+{
+  struct tgroup *tg = myproc()->tg;
+  int fd, n;
+
+  for(;;){
+    acquire(&tg->lock);
+    for(fd = 0; fd < tg->nofile; fd++){
+      if(tg->ofile[fd] == 0){
+        tg->ofile[fd] = f;
+        release(&tg->lock);
+        return fd;
+      }
+    }
+    n = tg->nofile;
+    release(&tg->lock);
+    if(n == MAXOFILE || fdgrow(tg, n*2 < MAXOFILE ? n*2 : MAXOFILE) < 0)
+      return -1;
+  }
+}
+
+// Return the open file for descriptor fd of the current
+// process, or 0. If other threads could close fd meanwhile, the
+// file comes with a new reference and *ref is set; a process
+// with one thread needs none, which keeps f->ref at what
+// ilockread() expects. Release the file with fdput(f, *ref).
+struct file*
+fdget(int fd, int *ref)
+{
+  struct tgroup *tg = myproc()->tg;
+  struct file *f = 0;
+
+  *ref = 0;
+  acquire(&tg->lock);
+  if(fd >= 0 && fd < tg->nofile && (f = tg->ofile[fd]) != 0 &&
+     tg->nthread > 1){
+    filedup(f);
+    *ref = 1;
+  }
+  release(&tg->lock);
+  return f;
+}
+
+void
+fdput(struct file *f, int ref)
+{
+  if(ref)
+    fileclose(f);
+}
+
+// Release descriptor fd of the current process and return
+// its file, or 0 if fd is not open. The descriptor's reference
+// passes to the caller.
+struct file*
+fdtake(int fd)
+{
+  struct tgroup *tg = myproc()->tg;
+  struct file *f = 0;
+
+  acquire(&tg->lock);
+  if(fd >= 0 && fd < tg->nofile){
+    f = tg->ofile[fd];
+    tg->ofile[fd] = 0;
+  }
+  release(&tg->lock);
+  return f;
+}
+
+// Return a new reference to the current directory.
+struct inode*
+cwdget(void)
+{
+  struct tgroup *tg = myproc()->tg;
+  struct inode *ip;
+
+  acquire(&tg->lock);
+  ip = idup(tg->cwd);
+  release(&tg->lock);
+  return ip;
+}
+
+// Make ip, a referenced inode, the current directory,
+// and return the old one, still referenced.
+struct inode*
+cwdswap(struct inode *ip)
+{
+  struct tgroup *tg = myproc()->tg;
+  struct inode *old;
+
+  acquire(&tg->lock);
+  old = tg->cwd;
+  tg->cwd = ip;
+  release(&tg->lock);
+  return old;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -345,12 +973,13 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  while((pp = p->children) != 0){
+    delchild(pp);
+    addchild(initproc, pp);
   }
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -361,22 +990,31 @@ exit(int status)
 {
   struct proc *p = myproc();
 
+  struct tgroup *tg = p->tg;
+  int last;
+
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
+  acquire(&tg->lock);
+  last = --tg->nlive == 0;
+  release(&tg->lock);
+
+  if(last){
+    // Close all open files.
+    for(int fd = 0; fd < tg->nofile; fd++){
+      if(tg->ofile[fd]){
+        struct file *f = tg->ofile[fd];
+        fileclose(f);
+        tg->ofile[fd] = 0;
+      }
     }
-  }
 
-  begin_op();
-  iput(p->cwd);
-  end_op();
-  p->cwd = 0;
+    begin_op();
+    iput(tg->cwd);
+    end_op();
+    tg->cwd = 0;
+  }
 
   acquire(&wait_lock);
 
@@ -402,6 +1040,24 @@ exit(int status)
 // Return -1 if this process has no children.
 int
 wait(uint64 addr)
+{
+  return reap(0, 0, addr);
+}
+
+// Wait for thread tid, or any thread if tid is 0, created by
+// this one to exit, and return its pid.
+// Return -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  return reap(1, tid, addr);
+}
+
+// Wait for an exited child, a thread if thread is set and
+// else a process, with the given pid if it is not 0.
+// init also reaps orphaned threads.
+static int
+reap(int thread, int pid0, uint64 addr)
 {
   struct proc *pp;
   int havekids, pid;
@@ -410,30 +1066,32 @@ wait(uint64 addr)
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&pp->lock);
-
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
+    for(pp = p->children; pp; pp = pp->nextsib){
+      if((pp->thread != thread && p != initproc) || (pid0 && pp->pid != pid0))
+        continue;
+
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&pp->lock);
+
+      havekids = 1;
+      if(pp->state == ZOMBIE){
+        // Found one.
+        pid = pp->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                                sizeof(pp->xstate)) < 0) {
           release(&pp->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        delchild(pp);
+        freeproc(pp);
         release(&pp->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&pp->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -459,6 +1117,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = c - cpus;
 
   c->proc = 0;
   for(;;){
@@ -467,29 +1126,50 @@ scheduler(void)
     // processes are waiting.
     intr_on();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
-      }
-      release(&p->lock);
-    }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
+    // hand back free kernel objects if kmem_reap() asked.
+    kmem_drain();
+
+    // say we are idle before looking, so that a CPU that
+    // queues a process after we look will send an IPI.
+    c->idle = 1;
+    __sync_synchronize();
+    if((p = pickproc(id)) == 0) {
+      // nothing to run; stop the clock until the next sleep()
+      // deadline, and stop running on this core until an interrupt.
+      timeridle();
       intr_on();
       asm volatile("wfi");
+      continue;
+    }
+    c->idle = 0;
+
+    // p is on no run queue now, so no other CPU can pick it,
+    // but the CPU that queued it may still be switching away
+    // from it; acquiring p->lock waits for that.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    catchboost(p);
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    // p's kernel stack may be newer than this CPU's TLB.
+    if(c->nkstack != procfree.n){
+      c->nkstack = procfree.n;
+      sfence_vma();
     }
+    timerrun();
+    trace(TR_SWITCH, p->prio, 0);
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -526,11 +1206,47 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
 
+// Called on each timer interrupt while a process runs.
+// Charges the tick to its time slice, and gives up the CPU
+// if the slice is used up, dropping a level, or if a process
+// of higher priority is waiting on this CPU.
+void
+schedtick(void)
+{
+  struct proc *p = myproc();
+  int i, preempt = 0;
+
+  acquire(&p->lock);
+  catchboost(p);
+  if(++p->used >= SLICE(p->prio)){
+    if(p->prio < NPRIO-1)
+      p->prio++;
+    p->used = 0;
+    preempt = 1;
+  }
+  for(i = 0; i < p->prio && !preempt; i++)
+    if(runq[p->cpu].head[i])   // racy peek
+      preempt = 1;
+  if(preempt){
+    setrunnable(p);
+    sched();
+  }
+  release(&p->lock);
+}
+
+// Start a new priority boost epoch. Called by the
+// clock interrupt every BOOSTTICKS ticks.
+void
+schedboost(void)
+{
+  __sync_fetch_and_add(&boostepoch, 1);
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -555,26 +1271,84 @@ forkret(void)
   usertrapret();
 }
 
+// Name the class of wait channels in [start, start+size),
+// for wakeup counting. Called during boot.
+void
+addwchan(char *name, void *start, uint64 size)
+{
+  struct wchanclass *wc;
+
+  if(nwchanclass >= NWCLASS)
+    panic("addwchan");
+  wc = &wchanclass[nwchanclass];
+  wc->name = name;
+  wc->start = (uint64)start;
+  wc->end = (uint64)start + size;
+  __sync_synchronize();
+  nwchanclass++;
+}
+
+// Name the class of wait channels in objects of cache c.
+// Called during boot.
+void
+addwchancache(char *name, struct kmem_cache *c)
+{
+  if(nwchanclass >= NWCLASS)
+    panic("addwchancache");
+  wchanclass[nwchanclass].name = name;
+  wchanclass[nwchanclass].cache = c;
+  __sync_synchronize();
+  nwchanclass++;
+}
+
+// A channel in a slab belongs to the class of the slab's
+// cache, if it has one; the page's cache may be changing
+// under us, which at worst miscounts a wakeup.
+static struct wchanclass*
+wchanof(void *chan)
+{
+  struct wchanclass *wc;
+  struct kmem_cache *c = 0;
+
+  if((uint64)chan >= KERNBASE && (uint64)chan < PHYSTOP)
+    c = pages[(uint64)chan / PGSIZE].cache;
+  if(c){
+    for(wc = &wchanclass[1]; wc < &wchanclass[nwchanclass]; wc++)
+      if(wc->cache == c)
+        return wc;
+  }
+  for(wc = &wchanclass[1]; wc < &wchanclass[nwchanclass]; wc++)
+    if(wc->cache == 0 && (uint64)chan >= wc->start && (uint64)chan < wc->end)
+      return wc;
+  return &wchanclass[0];
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = WAITQ(chan);
   
-  // Must acquire p->lock in order to
-  // change p->state and then call sched.
-  // Once we hold p->lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // Must join chan's wait queue and acquire
+  // p->lock in order to change p->state and
+  // then call sched. Once we hold wq->lock,
+  // we can be guaranteed that we won't miss
+  // any wakeup (wakeup locks wq->lock),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&wq->lock);  //DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // Go to sleep.
+  trace(TR_SLEEP, (uint64)chan, 0);
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = wq->head;
+  wq->head = p;
+  release(&wq->lock);
 
   sched();
 
@@ -591,17 +1365,70 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  wakeupn(chan, -1);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+// Wake up at most n processes sleeping on chan, or all of
+// them if n is negative, longest sleeping first.
+// Returns the number woken.
+// Must be called without any p->lock.
+int
+wakeupn(void *chan, int n)
+{
+  struct waitq *wq = WAITQ(chan);
+  struct proc *p, **pp;
+  struct wchanclass *wc;
+  int skip = 0, woken = 0;
+
+  acquire(&wq->lock);
+  if(n >= 0){
+    // the queue is newest first; pass over all but the last n.
+    for(p = wq->head; p != 0; p = p->wqnext)
+      if(p->chan == chan)
+        skip++;
+    skip -= n;
+  }
+  for(pp = &wq->head; (p = *pp) != 0; ){
+    // p->chan cannot change while p is on the queue.
+    if(p->chan == chan && skip-- <= 0){
+      *pp = p->wqnext;
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
+      setrunnable(p);
       release(&p->lock);
+      woken++;
+    } else {
+      pp = &p->wqnext;
     }
   }
+  release(&wq->lock);
+  trace(TR_WAKEUP, (uint64)chan, woken);
+
+  wc = wchanof(chan);
+  __sync_fetch_and_add(&wc->wakeups, 1);
+  __sync_fetch_and_add(&wc->woken, woken);
+  return woken;
+}
+
+// Take p off the wait queue for chan and make it RUNNABLE,
+// if it is still sleeping there.
+// Must be called without any p->lock.
+static void
+wakeproc(struct proc *p, void *chan)
+{
+  struct waitq *wq = WAITQ(chan);
+  struct proc **pp;
+
+  acquire(&wq->lock);
+  for(pp = &wq->head; *pp != 0; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      acquire(&p->lock);
+      setrunnable(p);
+      release(&p->lock);
+      break;
+    }
+  }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -611,21 +1438,45 @@ int
 kill(int pid)
 {
   struct proc *p;
+  void *chan;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep(). The wait queue's
+    // lock comes before p->lock, so let go first.
+    chan = p->chan;
     release(&p->lock);
+    wakeproc(p, chan);
+    return 0;
   }
-  return -1;
+  release(&p->lock);
+  return 0;
+}
+
+// Set the nice level of process pid, or of the caller if
+// pid is 0: the priority level it starts at and is boosted
+// back to. Returns the old nice level, or -1.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+  int old;
+
+  if(nice < 0 || nice >= NPRIO)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+
+  if((p = findproc(pid)) == 0)
+    return -1;
+  old = p->nice;
+  p->nice = nice;
+  p->prio = nice;
+  p->used = 0;
+  release(&p->lock);
+  return old;
 }
 
 void
@@ -695,14 +1546,19 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = procfree.all; p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %d %s", p->pid, state, p->prio, p->name);
     printf("\n");
   }
+  printf("wakeups (calls/woken):");
+  for(int i = 0; i < nwchanclass; i++)
+    printf(" %s %ld/%ld", wchanclass[i].name,
+           wchanclass[i].wakeups, wchanclass[i].woken);
+  printf("\n");
 }
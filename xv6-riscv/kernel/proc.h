@@ -24,6 +24,12 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // In scheduler() with nothing to run?
+  uint64 timer;               // Time of the next timer interrupt.
+  uint64 ticknext;            // Time to charge the next tick.
+  int nkstack;                // Kernel stacks mapped when TLB last flushed.
+  pagetable_t upagetable;     // User page table in the TLB, or null.
+  uint nutrap;                // Traps from user space so far.
 };
 
 extern struct cpu cpus[NCPU];
@@ -91,17 +97,59 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p last joined
+  int nice;                    // Priority level p starts at and is boosted to
+  int prio;                    // Current priority level, 0 is highest
+  int used;                    // Ticks used of the time slice at prio
+  int epoch;                   // Last priority boost applied to p
 
-  // wait_lock must be held when using this:
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next RUNNABLE process on the run queue
+
+  // the wait queue's lock must be held when using this:
+  struct proc *wqnext;         // Next process sleeping in the wait queue
+
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child process
+  struct proc *nextsib;        // Next child of the same parent
+  struct proc *prevsib;        // Previous child of the same parent
+
+  // pid_lock must be held when using this:
+  struct proc *pidnext;        // Next process in the same PID hash chain
+
+  // procfree.lock must be held when using these:
+  struct proc *nextfree;       // Next UNUSED process on the free list
+  struct proc *allnext;        // Next process on the list of all procs
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 tfva;                 // User address of trapframe
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct tgroup *tg;           // Shared with the process's threads
+  int thread;                  // Created by clone()?
   char name[16];               // Process name (debugging)
 };
+
+// What the threads of a process share besides the page table:
+// the size of its memory, the layout of its trapframes, its open
+// files and its current directory. Each thread has its own struct
+// proc, with its own trapframe, kernel stack and user stack, and
+// its own copy of the pagetable pointer.
+// Lock order: vmlock, then p->lock, then lock.
+struct tgroup {
+  struct spinlock lock;
+  struct sleeplock vmlock; // held while changing the page table
+
+  // vmlock must be held to change this:
+  uint64 sz;               // Size of process memory (bytes)
+
+  int nthread;             // threads not yet freed
+  int nlive;               // threads not yet exited
+  uint frames;             // THREADFRAME slots in use
+  struct file **ofile;     // Open files
+  int nofile;              // Size of ofile
+  struct inode *cwd;       // Current directory
+};
@@ -0,0 +1,109 @@
+// Sampling profiler.
+//
+// While profiling is on, a hart running a process takes a
+// timer interrupt PROFHZ times a second instead of HZ, and
+// devintr() records the interrupted pc, and whether it was
+// in user space, in the hart's own ring of samples. Idle
+// harts turn their timer off, so they take few samples.
+//
+// profread() drains the rings into a user buffer. A full
+// ring drops new samples, and counts them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFSAMPLE 1024  // samples each hart can hold
+#define NPROFBATCH  16    // samples copied out at a time
+
+struct profbuf {
+  struct spinlock lock;
+  struct profsample s[NPROFSAMPLE];
+  uint r, w;              // samples read and written so far
+  uint dropped;
+} profbuf[NCPU];
+
+int profiling;
+
+void
+profinit(void)
+{
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&profbuf[i].lock, "prof");
+}
+
+// Record a sample of this hart, interrupted at pc.
+// Called by devintr() with interrupts off.
+void
+profsample(uint64 pc, int user)
+{
+  struct profbuf *b = &profbuf[cpuid()];
+  struct proc *p = myproc();
+  struct profsample *s;
+
+  acquire(&b->lock);
+  if(b->w - b->r == NPROFSAMPLE){
+    b->dropped++;
+  } else {
+    s = &b->s[b->w++ % NPROFSAMPLE];
+    s->pc = pc;
+    s->pid = p ? p->pid : 0;
+    s->cpu = cpuid();
+    s->user = user;
+  }
+  release(&b->lock);
+}
+
+// Turn sampling on, discarding old samples, or off.
+// Returns the number of samples dropped for want of
+// room since sampling was last turned on.
+int
+profile(int on)
+{
+  struct profbuf *b;
+  int dropped = 0;
+
+  for(b = profbuf; b < &profbuf[NCPU]; b++){
+    acquire(&b->lock);
+    dropped += b->dropped;
+    if(on)
+      b->r = b->w = b->dropped = 0;
+    release(&b->lock);
+  }
+  // running harts speed up their timers at their next tick.
+  __atomic_store_n(&profiling, on != 0, __ATOMIC_RELAXED);
+  return dropped;
+}
+
+// Move up to n samples to the user array of struct
+// profsample at addr. Returns the number moved, or -1.
+int
+profread(uint64 addr, int n)
+{
+  struct profsample s[NPROFBATCH];
+  struct profbuf *b;
+  int k, got = 0;
+
+  for(b = profbuf; b < &profbuf[NCPU]; b++){
+    for(;;){
+      acquire(&b->lock);
+      for(k = 0; k < NPROFBATCH && got + k < n && b->r != b->w; k++)
+        s[k] = b->s[b->r++ % NPROFSAMPLE];
+      release(&b->lock);
+      if(k == 0)
+        break;
+      if(copyout(myproc()->pagetable, addr + got*sizeof(s[0]), (char*)s, k*sizeof(s[0])) < 0)
+        return -1;
+      got += k;
+    }
+  }
+  return got;
+}
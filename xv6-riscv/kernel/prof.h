@@ -0,0 +1,11 @@
+// Samples taken by the kernel's sampling profiler.
+// Both the kernel and user programs use this header file.
+
+#define PROFHZ 1000  // samples per second on each busy hart
+
+struct profsample {
+  uint64 pc;    // interrupted program counter
+  int pid;      // process running, or 0 if none
+  char cpu;     // hart that took the sample
+  char user;    // 1 if the hart was in user mode
+};
@@ -0,0 +1,227 @@
+// Batched system calls through a ring shared with user space
+// (see ring.h).
+//
+// ringsetup() maps a zeroed page at RING, above the heap, where
+// fork() does not copy it, and off the LRU list, so swap_out()
+// never takes it; the kernel reaches it at its physical address. ringenter() runs
+// the queued submissions one after another, each as its system
+// call would, until the submission ring is empty or the
+// completion ring is full, all for the price of one trap.
+//
+// With RING_POLL the calling thread instead stays in the kernel
+// serving the ring as submissions arrive, so that the other
+// threads of the process need no system calls at all. After
+// POLLIDLE without work it sets needwake and sleeps; a submitter
+// that sees needwake calls ringenter(RING_WAKE).
+//
+// User code can change the ring at any time, so the kernel
+// copies each submission before looking at it and uses indices
+// only modulo RINGSIZE. A sleeplock per hash bucket keeps two
+// threads from running the same ring at once.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "ring.h"
+
+#define NRINGLOCK 16
+#define RINGLOCK(pa) (&ringlock[((pa) >> PGSHIFT) % NRINGLOCK])
+#define POLLIDLE (TIMEBASE/100)  // 10ms
+
+struct sleeplock ringlock[NRINGLOCK];
+struct spinlock ringwake;  // for needwake and sleeping pollers
+
+void
+ringinit(void)
+{
+  int i;
+
+  for(i = 0; i < NRINGLOCK; i++)
+    initsleeplock(&ringlock[i], "ring");
+  initlock(&ringwake, "ringwake");
+}
+
+// Map a ring at RING if there is none yet.
+// Returns RING, or -1 if out of memory.
+uint64
+ringsetup(void)
+{
+  struct proc *p = myproc();
+  char *mem;
+
+  vmlock();
+  if(walkaddr(p->pagetable, RING) == 0){
+    if((mem = kalloc()) == 0){
+      vmunlock();
+      return -1;
+    }
+    memset(mem, 0, PGSIZE);
+    if(mapkpage(p->pagetable, RING, (uint64)mem, PTE_R | PTE_W | PTE_U) < 0){
+      kfree(mem);
+      vmunlock();
+      return -1;
+    }
+  }
+  vmunlock();
+  return RING;
+}
+
+// Unmap and free the ring, if any, of a page table
+// that is being freed. It is on no LRU list.
+void
+ringfree(pagetable_t pagetable)
+{
+  uint64 pa;
+
+  if((pa = walkaddr(pagetable, RING)) != 0){
+    uvmunmap(pagetable, RING, 1, 0);
+    kfree((void*)pa);
+  }
+}
+
+static int
+ringop(struct ringsqe *e)
+{
+  struct proc *p = myproc();
+  struct file *f;
+  char path[MAXPATH];
+  int r, ref;
+
+  switch(e->op){
+  case RING_NOP:
+    return 0;
+  case RING_OPEN:
+    if(copyinstr(p->pagetable, path, e->addr, MAXPATH) < 0)
+      return -1;
+    return fileopen(path, e->n);
+  case RING_CLOSE:
+    if((f = fdtake(e->fd)) == 0)
+      return -1;
+    fileclose(f);
+    return 0;
+  case RING_SWAPSTAT:
+    if(copyout(p->pagetable, e->addr, (char*)&nr_sectors_read, sizeof(int)) < 0 ||
+       copyout(p->pagetable, e->addr + sizeof(int), (char*)&nr_sectors_write, sizeof(int)) < 0)
+      return -1;
+    return 0;
+  case RING_READ:
+  case RING_WRITE:
+  case RING_FSTAT:
+    if((f = fdget(e->fd, &ref)) == 0)
+      return -1;
+    if(e->op == RING_READ)
+      r = fileread(f, e->addr, e->n);
+    else if(e->op == RING_WRITE)
+      r = filewrite(f, e->addr, e->n);
+    else
+      r = filestat(f, e->addr);
+    fdput(f, ref);
+    return r;
+  }
+  return -1;
+}
+
+// Run submissions until there are none or there is no room
+// for their completions. Returns the number run.
+// The caller holds the ring's sleeplock.
+static int
+ringrun(struct ring *r)
+{
+  struct ringsqe e;
+  struct ringcqe *c;
+  uint head, tail;
+  int n = 0;
+
+  head = r->sqhead;
+  tail = r->cqtail;
+  while(head != __atomic_load_n(&r->sqtail, __ATOMIC_ACQUIRE) &&
+        tail - __atomic_load_n(&r->cqhead, __ATOMIC_ACQUIRE) < RINGSIZE){
+    e = r->sq[head % RINGSIZE];
+    __atomic_store_n(&r->sqhead, ++head, __ATOMIC_RELEASE);
+    c = &r->cq[tail % RINGSIZE];
+    c->data = e.data;
+    c->res = ringop(&e);
+    __atomic_store_n(&r->cqtail, ++tail, __ATOMIC_RELEASE);
+    n++;
+  }
+  return n;
+}
+
+// Serve the ring until user code sets stop or the thread
+// is killed.
+static int
+ringpoll(struct ring *r, uint64 pa)
+{
+  struct proc *p = myproc();
+  uint64 idle = r_time();
+  int n;
+
+  while(!killed(p)){
+    if(__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE))
+      return 0;
+    acquiresleep(RINGLOCK(pa));
+    n = ringrun(r);
+    releasesleep(RINGLOCK(pa));
+    if(n > 0){
+      idle = r_time();
+      continue;
+    }
+    if(r_time() - idle < POLLIDLE){
+      yield();
+      continue;
+    }
+
+    // set needwake before looking for work one last time; a
+    // submitter advances sqtail before looking at needwake,
+    // so one of the two sees the other.
+    acquire(&ringwake);
+    __atomic_store_n(&r->needwake, 1, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&r->sqtail, __ATOMIC_SEQ_CST) == r->sqhead &&
+       !__atomic_load_n(&r->stop, __ATOMIC_SEQ_CST))
+      sleep(r, &ringwake);
+    __atomic_store_n(&r->needwake, 0, __ATOMIC_SEQ_CST);
+    release(&ringwake);
+    idle = r_time();
+  }
+  return -1;
+}
+
+// With no flags, run the queued submissions and return how
+// many ran. RING_WAKE wakes the ring's poller, and RING_POLL
+// makes this thread the poller until stop is set.
+int
+ringenter(int flags)
+{
+  struct proc *p = myproc();
+  struct ring *r;
+  uint64 pa;
+  int n;
+
+  vmlock();
+  pa = walkaddr(p->pagetable, RING);
+  vmunlock();
+  if(pa == 0)
+    return -1;
+  r = (struct ring*)pa;
+
+  if(flags & RING_WAKE){
+    acquire(&ringwake);
+    wakeup(r);
+    release(&ringwake);
+    return 0;
+  }
+  if(flags & RING_POLL)
+    return ringpoll(r, pa);
+
+  acquiresleep(RINGLOCK(pa));
+  n = ringrun(r);
+  releasesleep(RINGLOCK(pa));
+  return n;
+}
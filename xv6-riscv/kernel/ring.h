@@ -0,0 +1,51 @@
+// A ring shared with the kernel for batching system calls,
+// mapped into user space by ringsetup().
+//
+// User code fills in sq[sqtail % RINGSIZE] and then advances
+// sqtail. The kernel runs the submissions in order, advancing
+// sqhead, and for each one posts a completion at
+// cq[cqtail % RINGSIZE] and advances cqtail. User code takes
+// the completions by advancing cqhead. The side that advances
+// an index stores it last, with release ordering, and the other
+// side loads it with acquire ordering.
+
+#define RINGSIZE 64   // entries in each ring; a power of two
+
+// operations, each like the system call of the same name.
+#define RING_NOP      0
+#define RING_READ     1  // fd, addr: buffer, n: length
+#define RING_WRITE    2  // fd, addr: buffer, n: length
+#define RING_OPEN     3  // addr: path, n: mode
+#define RING_CLOSE    4  // fd
+#define RING_FSTAT    5  // fd, addr: struct stat
+#define RING_SWAPSTAT 6  // addr: int[2] for sectors read and written
+
+// ringenter() flags
+#define RING_WAKE     1  // wake a sleeping poller
+#define RING_POLL     2  // serve the ring until stop is set
+
+struct ringsqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int n;
+  int pad;
+  uint64 data;    // copied to the completion
+};
+
+struct ringcqe {
+  uint64 data;
+  int res;        // what the system call would return
+  int pad;
+};
+
+struct ring {
+  uint sqhead;    // next submission the kernel takes
+  uint sqtail;    // next submission slot user code fills
+  uint cqhead;    // next completion user code takes
+  uint cqtail;    // next completion slot the kernel fills
+  uint needwake;  // the poller is asleep: ringenter(RING_WAKE)
+  uint stop;      // set by user code to end polling
+  struct ringsqe sq[RINGSIZE];
+  struct ringcqe cq[RINGSIZE];
+};
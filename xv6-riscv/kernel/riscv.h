@@ -17,6 +17,7 @@ r_mhartid()
 #define MSTATUS_MPP_U (0L << 11)
 #define MSTATUS_MIE (1L << 3)    // machine-mode interrupt enable.
 #define PTE_A (1L << 6)
+#define PTE_C (1L << 8) // copy-on-write: page is lent to a pipe
 #define PTE_S (1L << 9)
 
 static inline uint64
@@ -65,6 +66,7 @@ w_sstatus(uint64 x)
 }
 
 // Supervisor Interrupt Pending
+#define SIP_SSIP (1L << 1) // software
 static inline uint64
 r_sip()
 {
@@ -98,6 +100,7 @@ w_sie(uint64 x)
 }
 
 // Machine-mode Interrupt Enable
+#define MIE_MSIE (1L << 3)  // machine software
 #define MIE_STIE (1L << 5)  // supervisor timer
 static inline uint64
 r_mie()
@@ -160,6 +163,19 @@ w_mideleg(uint64 x)
   asm volatile("csrw mideleg, %0" : : "r" (x));
 }
 
+// Machine-mode Trap-Vector Base Address
+static inline void 
+w_mtvec(uint64 x)
+{
+  asm volatile("csrw mtvec, %0" : : "r" (x));
+}
+
+static inline void 
+w_mscratch(uint64 x)
+{
+  asm volatile("csrw mscratch, %0" : : "r" (x));
+}
+
 // Supervisor Trap-Vector Base Address
 // low two bits are mode.
 static inline void 
@@ -277,6 +293,21 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -353,10 +384,18 @@ typedef uint64 *pagetable_t; // 512 PTEs
 
 // pa4: page struct
 struct page{
-	struct page *next;
+	struct page *next;  // LRU list, or a slab list (slab.c)
 	struct page *prev;
 	pagetable_t  pagetable;
 	char *vaddr;
+	int refcnt;   // mappings and pipe loans holding the page (lru_lock)
+	struct inode *ip;  // page cache: file and page number (pcache lock)
+	uint pgno;
+	int dirty;         // page cache: mask of blocks not yet on disk
+	uint blkaddr[4];   // page cache: disk address of each block (PGSIZE/BSIZE)
+	struct kmem_cache *cache;  // slab: cache the page is carved into
+	void *freeobj;             // slab: free objects (cache lock)
+	int inuse;                 // slab: objects handed out
 };
 
 
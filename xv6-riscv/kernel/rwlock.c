@@ -0,0 +1,139 @@
+// Reader-writer spin locks and sequence locks.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+void
+initrwlock(struct rwlock *lk, char *name)
+{
+  lk->name = name;
+  lk->readers = 0;
+  lk->wwait = 0;
+  lk->cpu = 0;
+}
+
+// Acquire the lock shared with other readers.
+// Must not be held already by this cpu, even for reading:
+// a waiting writer would hold off the second acquire.
+void
+acquireread(struct rwlock *lk)
+{
+  int r;
+
+  push_off(); // disable interrupts to avoid deadlock.
+  if(lk->cpu == mycpu())
+    panic("acquireread");
+
+  for(;;){
+    while(__atomic_load_n(&lk->wwait, __ATOMIC_RELAXED) != 0 ||
+          (r = __atomic_load_n(&lk->readers, __ATOMIC_RELAXED)) < 0)
+      ;
+    if(__sync_bool_compare_and_swap(&lk->readers, r, r + 1))
+      break;
+  }
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwlock *lk)
+{
+  if(lk->readers <= 0)
+    panic("releaseread");
+  __sync_synchronize();
+  __sync_fetch_and_sub(&lk->readers, 1);
+  pop_off();
+}
+
+// Acquire the lock alone.
+void
+acquirewrite(struct rwlock *lk)
+{
+  push_off();
+  if(lk->cpu == mycpu())
+    panic("acquirewrite");
+
+  __sync_fetch_and_add(&lk->wwait, 1);
+  while(!__sync_bool_compare_and_swap(&lk->readers, 0, -1))
+    ;
+  __sync_fetch_and_sub(&lk->wwait, 1);
+  __sync_synchronize();
+  lk->cpu = mycpu();
+}
+
+void
+releasewrite(struct rwlock *lk)
+{
+  if(lk->readers != -1 || lk->cpu != mycpu())
+    panic("releasewrite");
+  lk->cpu = 0;
+  __sync_synchronize();
+  __atomic_store_n(&lk->readers, 0, __ATOMIC_RELAXED);
+  pop_off();
+}
+
+void
+initseqlock(struct seqlock *sl, char *name)
+{
+  initlock(&sl->lock, name);
+  sl->seq = 0;
+}
+
+// Start changing the data: lock out other writers,
+// and make readers retry.
+void
+writeseqlock(struct seqlock *sl)
+{
+  acquire(&sl->lock);
+  writeseqbegin(sl);
+}
+
+void
+writesequnlock(struct seqlock *sl)
+{
+  writeseqend(sl);
+  release(&sl->lock);
+}
+
+// Mark a change for a writer already holding sl->lock.
+void
+writeseqbegin(struct seqlock *sl)
+{
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+  __sync_synchronize();
+}
+
+void
+writeseqend(struct seqlock *sl)
+{
+  __sync_synchronize();
+  __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+}
+
+// Start reading, waiting out a writer that is busy now.
+// Returns the sequence number to pass to readseqretry().
+uint
+readseqbegin(struct seqlock *sl)
+{
+  uint seq;
+
+  while((seq = __atomic_load_n(&sl->seq, __ATOMIC_RELAXED)) & 1)
+    ;
+  __sync_synchronize();
+  return seq;
+}
+
+// Return whether the data read since readseqbegin()
+// returned seq may be inconsistent, and must be read again.
+int
+readseqretry(struct seqlock *sl, uint seq)
+{
+  __sync_synchronize();
+  return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
@@ -0,0 +1,27 @@
+// Reader-writer spin lock.
+// Any number of readers, or one writer, may hold it.
+// Waiting writers hold back new readers, so a stream of
+// readers cannot keep a writer out for ever.
+struct rwlock {
+  int readers;       // readers holding it, or -1 if a writer does
+  uint wwait;        // writers waiting
+
+  // For debugging:
+  char *name;        // Name of lock.
+  struct cpu *cpu;   // The cpu holding it for writing.
+};
+
+// Sequence lock, for small data read far more often than
+// written. Readers take no lock and write nothing; they
+// read again if a writer was busy meanwhile:
+//
+//   do {
+//     seq = readseqbegin(&sl);
+//     ... copy the data ...
+//   } while(readseqretry(&sl, seq));
+//
+// Writers hold lock, which they may also use with sleep().
+struct seqlock {
+  uint seq;              // odd while a writer is busy
+  struct spinlock lock;  // serializes writers
+};
@@ -0,0 +1,367 @@
+// Slab allocator for small kernel objects.
+//
+// A kmem_cache hands out objects of one size, carved from
+// whole pages ("slabs") obtained with kalloc(). Each slab's
+// struct page records its cache, its free objects and how
+// many are in use. A cache keeps partly used slabs on one
+// list and unused slabs on another; full slabs are on none.
+//
+// Each CPU keeps a few free objects of each cache, so that
+// most allocations and frees take no lock. They move to and
+// from the slabs in batches.
+//
+// A cache keeps at most KMEMPTY unused slabs; kalloc() calls
+// kmem_reap() to take back the rest when memory runs out.
+// Only a CPU itself touches its free objects, so shrinking asks
+// the other CPUs to hand theirs back, which each does the next
+// time its scheduler loop calls kmem_drain().
+//
+// kmalloc() and kmfree() serve variable-sized requests from
+// caches of power-of-two sizes, up to a whole page.
+//
+// kmem_cache_alloc() and kmalloc() may have to wait for
+// kalloc() to swap a page out, so they must not be called
+// while holding a spinlock. Freeing never waits.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NKMCACHE 16
+#define KMMIN    16   // smallest kmalloc() size
+#define KMCPU    16   // most free objects a CPU keeps per cache
+#define KMEMPTY  1    // unused slabs a cache keeps
+
+struct obj {
+  struct obj *next;
+};
+
+struct kmcpu {
+  int n;
+  void *obj[KMCPU];
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;             // object size
+  int perslab;           // objects per slab
+  int cpumax;            // most objects kept per CPU
+  int batch;             // objects moved at a time
+  struct spinlock lock;  // protects the slabs
+  struct page *partial;  // slabs with objects in use and free
+  struct page *empty;    // slabs with no objects in use
+  int nempty;
+  int npages;            // slabs in all
+  struct kmcpu cpu[NCPU];  // each CPU's, with interrupts off
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NKMCACHE];
+  int n;
+} kmcaches;
+
+// kmalloc() caches, for sizes KMMIN, 2*KMMIN, ..., PGSIZE.
+static struct kmem_cache *kmsize[16];
+
+// Bumped to ask every CPU to hand back its free objects;
+// drained[i] is the last request CPU i has served.
+static int drainreq;
+static int drained[NCPU];
+
+void
+slabinit(void)
+{
+  uint size;
+  int i;
+
+  initlock(&kmcaches.lock, "kmcaches");
+  for(i = 0, size = KMMIN; size <= PGSIZE; i++, size *= 2)
+    kmsize[i] = kmem_cache_create("kmalloc", size);
+}
+
+// Create a cache of objects of size bytes.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  if(size > PGSIZE)
+    panic("kmem_cache_create: too big");
+  // keep objects pointer-aligned.
+  size = (size + sizeof(uint64) - 1) & ~(sizeof(uint64) - 1);
+  if(size < sizeof(struct obj))
+    size = sizeof(struct obj);
+
+  acquire(&kmcaches.lock);
+  if(kmcaches.n == NKMCACHE)
+    panic("kmem_cache_create: no caches");
+  c = &kmcaches.cache[kmcaches.n++];
+  release(&kmcaches.lock);
+
+  c->name = name;
+  c->size = size;
+  c->perslab = PGSIZE / size;
+  // don't let CPUs hoard many pages of big objects.
+  c->cpumax = c->perslab < KMCPU ? c->perslab : KMCPU;
+  c->batch = (c->cpumax + 1) / 2;
+  initlock(&c->lock, name);
+  return c;
+}
+
+static char*
+slabaddr(struct page *s)
+{
+  return (char*)((s - pages) * PGSIZE);
+}
+
+// Push slab s on the list at *head. Caller holds c->lock.
+static void
+slab_link(struct page **head, struct page *s)
+{
+  s->prev = 0;
+  s->next = *head;
+  if(*head)
+    (*head)->prev = s;
+  *head = s;
+}
+
+// Remove slab s from the list at *head. Caller holds c->lock.
+static void
+slab_unlink(struct page **head, struct page *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *head = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+// Take a free object from c's slabs, or return 0 if there is
+// none. Caller holds c->lock.
+static void*
+slab_take(struct kmem_cache *c)
+{
+  struct page *s;
+  struct obj *o;
+
+  if((s = c->partial) == 0){
+    if((s = c->empty) == 0)
+      return 0;
+    slab_unlink(&c->empty, s);
+    c->nempty--;
+    slab_link(&c->partial, s);
+  }
+  o = s->freeobj;
+  s->freeobj = o->next;
+  if(++s->inuse == c->perslab)
+    slab_unlink(&c->partial, s);
+  return o;
+}
+
+// Return object x to its slab. Caller holds c->lock.
+static void
+slab_put(struct kmem_cache *c, void *x)
+{
+  struct page *s = &pages[(uint64)x / PGSIZE];
+  struct obj *o = x;
+
+  if(s->inuse == c->perslab)
+    slab_link(&c->partial, s);
+  o->next = s->freeobj;
+  s->freeobj = o;
+  if(--s->inuse == 0){
+    slab_unlink(&c->partial, s);
+    slab_link(&c->empty, s);
+    c->nempty++;
+  }
+}
+
+// Give all but keep of c's unused slabs back to kalloc().
+// Returns the number of pages freed. Caller holds c->lock.
+static int
+slab_trim(struct kmem_cache *c, int keep)
+{
+  struct page *s;
+  int n = 0;
+
+  while(c->nempty > keep){
+    s = c->empty;
+    slab_unlink(&c->empty, s);
+    c->nempty--;
+    c->npages--;
+    s->cache = 0;
+    s->freeobj = 0;
+    kfree(slabaddr(s));
+    n++;
+  }
+  return n;
+}
+
+// Add a new slab to c and take an object from it,
+// or return 0 if there is no memory.
+static void*
+slab_grow(struct kmem_cache *c)
+{
+  struct page *s;
+  char *pa, *x;
+  struct obj *o;
+
+  if((pa = kalloc()) == 0)
+    return 0;
+  s = &pages[(uint64)pa / PGSIZE];
+  s->cache = c;
+  s->inuse = 0;
+  s->freeobj = 0;
+  for(x = pa + (c->perslab - 1) * c->size; x >= pa; x -= c->size){
+    o = (struct obj*)x;
+    o->next = s->freeobj;
+    s->freeobj = o;
+  }
+
+  acquire(&c->lock);
+  slab_link(&c->empty, s);
+  c->nempty++;
+  c->npages++;
+  x = slab_take(c);
+  release(&c->lock);
+  return x;
+}
+
+// Return a zeroed object from cache c,
+// or 0 if there is no memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct kmcpu *kc;
+  void *x;
+
+  push_off();
+  kc = &c->cpu[cpuid()];
+  if(kc->n == 0){
+    acquire(&c->lock);
+    while(kc->n < c->batch && (x = slab_take(c)) != 0)
+      kc->obj[kc->n++] = x;
+    release(&c->lock);
+  }
+  x = kc->n > 0 ? kc->obj[--kc->n] : 0;
+  pop_off();
+
+  if(x == 0 && (x = slab_grow(c)) == 0)
+    return 0;
+  memset(x, 0, c->size);
+  return x;
+}
+
+// Return object x to cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *x)
+{
+  struct kmcpu *kc;
+
+  if(pages[(uint64)x / PGSIZE].cache != c)
+    panic("kmem_cache_free");
+
+  push_off();
+  kc = &c->cpu[cpuid()];
+  if(kc->n == c->cpumax){
+    acquire(&c->lock);
+    while(kc->n > c->cpumax - c->batch)
+      slab_put(c, kc->obj[--kc->n]);
+    slab_trim(c, KMEMPTY);
+    release(&c->lock);
+  }
+  kc->obj[kc->n++] = x;
+  pop_off();
+}
+
+// Return this CPU's free objects of c to its slabs, and give
+// all but keep of c's unused slabs back to kalloc().
+// Returns the number of pages freed.
+static int
+cpu_drain(struct kmem_cache *c, int keep)
+{
+  struct kmcpu *kc;
+  int n;
+
+  push_off();
+  kc = &c->cpu[cpuid()];
+  acquire(&c->lock);
+  while(kc->n > 0)
+    slab_put(c, kc->obj[--kc->n]);
+  n = slab_trim(c, keep);
+  release(&c->lock);
+  pop_off();
+  return n;
+}
+
+// Give c's unused slabs back to kalloc(), along with this
+// CPU's free objects, and ask the other CPUs for theirs.
+// Returns the number of pages freed now.
+int
+kmem_cache_shrink(struct kmem_cache *c)
+{
+  __sync_fetch_and_add(&drainreq, 1);
+  return cpu_drain(c, 0);
+}
+
+// Hand this CPU's free objects back to their slabs if another
+// CPU has asked since the last time. Called by the scheduler.
+void
+kmem_drain(void)
+{
+  int i, id, req;
+
+  push_off();
+  id = cpuid();
+  req = __atomic_load_n(&drainreq, __ATOMIC_ACQUIRE);
+  if(drained[id] != req){
+    drained[id] = req;
+    for(i = 0; i < kmcaches.n; i++)
+      cpu_drain(&kmcaches.cache[i], 0);
+  }
+  pop_off();
+}
+
+// Shrink every cache. Called by kalloc() when memory runs out.
+// Returns the number of pages freed.
+int
+kmem_reap(void)
+{
+  int i, n = 0;
+
+  for(i = 0; i < kmcaches.n; i++)
+    n += kmem_cache_shrink(&kmcaches.cache[i]);
+  return n;
+}
+
+// Allocate n zeroed bytes, at most a page,
+// or return 0 if there is no memory.
+void*
+kmalloc(uint n)
+{
+  int i;
+  uint size;
+
+  if(n > PGSIZE)
+    panic("kmalloc: too big");
+  for(i = 0, size = KMMIN; size < n; i++, size *= 2)
+    ;
+  return kmem_cache_alloc(kmsize[i]);
+}
+
+// Free memory returned by kmalloc().
+void
+kmfree(void *x)
+{
+  struct kmem_cache *c = pages[(uint64)x / PGSIZE].cache;
+
+  if(c == 0)
+    panic("kmfree");
+  kmem_cache_free(c, x);
+}
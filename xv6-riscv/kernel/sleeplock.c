@@ -1,4 +1,11 @@
 // Sleeping locks
+//
+// A process that finds the lock held by a process running on
+// another CPU spins for a while before it sleeps, since that
+// holder will likely let go sooner than a trip through the
+// scheduler would take. It sleeps at once if the holder is not
+// running, as when it waits for the disk, or holds the lock
+// shared.
 
 #include "types.h"
 #include "riscv.h"
@@ -6,27 +13,70 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
-#include "proc.h"
 #include "sleeplock.h"
+#include "proc.h"
+
+#define SPINTIME (TIMEBASE/50000)  // 20us: longest spin, in time CSR ticks
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
-  initlock(&lk->lk, "sleep lock");
+  // name the spinlock too, so lockstat shows each kind apart.
+  initlock(&lk->lk, name);
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
   lk->pid = 0;
+  lk->owner = 0;
+}
+
+// Spin, without lk->lk, while lk is held alone by a process
+// running on another CPU, until the holder lets go or changes,
+// or the time CSR passes deadline.
+// Called and returns with lk->lk held.
+// Returns 0 if the caller should sleep instead.
+static int
+spinwait(struct sleeplock *lk, uint64 deadline)
+{
+  struct proc *owner = lk->owner;
+
+  if(owner == 0 || __atomic_load_n(&owner->state, __ATOMIC_RELAXED) != RUNNING ||
+     r_time() >= deadline)
+    return 0;
+
+  release(&lk->lk);
+  // proc structs are never freed, so owner stays safe to look at.
+  while(__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == owner &&
+        __atomic_load_n(&owner->state, __ATOMIC_RELAXED) == RUNNING &&
+        r_time() < deadline)
+    ;
+  acquire(&lk->lk);
+  return lk->owner != owner;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  uint64 deadline;
+  int waited = 0, slept = 0;
+
   acquire(&lk->lk);
-  while (lk->locked) {
-    sleep(lk, &lk->lk);
+  lk->wwait++;
+  deadline = r_time() + SPINTIME;
+  while (lk->locked || lk->readers) {
+    waited = 1;
+    if(!spinwait(lk, deadline)){
+      slept = 1;
+      sleep(lk, &lk->lk);
+    }
   }
+  if(waited)
+    lockstat_sleep(&lk->lk, slept);
+  lk->wwait--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->owner = myproc();
   release(&lk->lk);
 }
 
@@ -36,10 +86,56 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
   wakeup(lk);
   release(&lk->lk);
 }
 
+// Acquire the lock shared with other readers.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  uint64 deadline;
+  int waited = 0, slept = 0;
+
+  acquire(&lk->lk);
+  deadline = r_time() + SPINTIME;
+  while (lk->locked || lk->wwait) {
+    waited = 1;
+    if(!spinwait(lk, deadline)){
+      slept = 1;
+      sleep(lk, &lk->lk);
+    }
+  }
+  if(waited)
+    lockstat_sleep(&lk->lk, slept);
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleepshared");
+  if(--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Return whether the lock is held shared, by someone.
+int
+holdingsleepshared(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->readers > 0;
+  release(&lk->lk);
+  return r;
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
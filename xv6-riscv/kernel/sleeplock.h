@@ -1,7 +1,13 @@
-// Long-term locks for processes
+// Long-term locks for processes.
+// Held either alone, or shared by any number of readers
+// with acquiresleepshared(). Waiting writers hold back new
+// readers.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held alone?
   struct spinlock lk; // spinlock protecting this sleep lock
+  int readers;       // Holders sharing it
+  int wwait;         // Processes waiting to hold it alone
+  struct proc *owner; // Process holding it alone
   
   // For debugging:
   char *name;        // Name of lock.
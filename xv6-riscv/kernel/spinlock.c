@@ -4,16 +4,67 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "lockstat.h"
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
 
+// Acquisition counts, by lock name. Each CPU counts in its
+// own row, with interrupts off, so counting takes no atomic
+// instructions. Names past the first NLOCKCLASS, and locks
+// used before initlock(), count as "other".
+struct lockcount {
+  uint64 nacquire;
+  uint64 ncontended;
+  uint64 spin;       // time CSR ticks spent waiting
+  uint64 nsleepwait;
+  uint64 nspinok;
+};
+
+struct {
+  uint adding;       // test-and-set lock for adding names
+  int n;
+  char *name[NLOCKCLASS];
+  struct lockcount count[NCPU][NLOCKCLASS];
+} lockstats = { .n = 1, .name = { "other" } };
+
+// Return the statistics slot for locks called name.
+static int
+lockclass(char *name)
+{
+  int i, n;
+
+  n = __atomic_load_n(&lockstats.n, __ATOMIC_ACQUIRE);
+  for(i = 0; i < n; i++)
+    if(strncmp(lockstats.name[i], name, LOCKNAME) == 0)
+      return i;
+
+  push_off();
+  while(__sync_lock_test_and_set(&lockstats.adding, 1) != 0)
+    ;
+  for(; i < lockstats.n; i++)
+    if(strncmp(lockstats.name[i], name, LOCKNAME) == 0)
+      break;
+  if(i == NLOCKCLASS){
+    i = 0;
+  } else if(i == lockstats.n){
+    lockstats.name[i] = name;
+    __atomic_store_n(&lockstats.n, i + 1, __ATOMIC_RELEASE);
+  }
+  __sync_lock_release(&lockstats.adding);
+  pop_off();
+  return i;
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->cls = lockclass(name);
 }
 
 // Acquire the lock.
@@ -21,16 +72,31 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  struct lockcount *lc;
+  uint ticket;
+  uint64 t0;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
   //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  //   s1 = &lk->next
+  //   amoadd.w a5, a5, (s1)
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+
+  lc = &lockstats.count[cpuid()][lk->cls];
+  lc->nacquire++;
+  if(__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) != ticket){
+    // wait our turn, only reading the lock's cache line
+    // until the holder before us writes owner.
+    lc->ncontended++;
+    t0 = r_time();
+    while(__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) != ticket)
+      ;
+    lc->spin += r_time() - t0;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -59,25 +125,33 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Hand the lock to the next ticket. Only the holder writes
+  // owner, but the store must be a single instruction, since
+  // the waiters read owner without a lock.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELAXED);
 
   pop_off();
 }
 
+// Count a wait for the sleeplock whose spinlock is lk,
+// and whether the waiter had to sleep. Caller holds lk.
+void
+lockstat_sleep(struct spinlock *lk, int slept)
+{
+  struct lockcount *lc = &lockstats.count[cpuid()][lk->cls];
+
+  lc->nsleepwait++;
+  if(!slept)
+    lc->nspinok++;
+}
+
 // Check whether this cpu is holding the lock.
 // Interrupts must be off.
 int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
   return r;
 }
 
@@ -108,3 +182,36 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Copy statistics for up to n lock names to the user array
+// of struct lockstat at addr, and return how many were copied.
+// With addr 0, reset the statistics instead.
+int
+lockstat(uint64 addr, int n)
+{
+  struct lockstat ls;
+  struct lockcount *lc;
+  int i, c;
+
+  if(addr == 0){
+    memset(lockstats.count, 0, sizeof(lockstats.count));
+    return 0;
+  }
+  if(n > lockstats.n)
+    n = lockstats.n;
+  for(i = 0; i < n; i++){
+    memset(&ls, 0, sizeof(ls));
+    safestrcpy(ls.name, lockstats.name[i], sizeof(ls.name));
+    for(c = 0; c < NCPU; c++){
+      lc = &lockstats.count[c][i];
+      ls.nacquire += lc->nacquire;
+      ls.ncontended += lc->ncontended;
+      ls.spinns += lc->spin * (1000000000 / TIMEBASE);
+      ls.nsleepwait += lc->nsleepwait;
+      ls.nspinok += lc->nspinok;
+    }
+    if(copyout(myproc()->pagetable, addr + i*sizeof(ls), (char*)&ls, sizeof(ls)) < 0)
+      return -1;
+  }
+  return n;
+}
@@ -1,9 +1,13 @@
 // Mutual exclusion lock.
+// A ticket lock: acquire() takes the next ticket and waits for
+// owner to reach it, so CPUs get the lock in the order they
+// asked for it, and waiters only read the lock while spinning.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out
+  uint owner;        // Ticket of the holder, or of the next holder
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  int cls;           // Statistics slot, shared by locks of this name
 };
-
@@ -6,10 +6,17 @@
 
 void main();
 void timerinit();
+void ipiinit();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// scratch area for machinevec in kernelvec.S, one per CPU.
+uint64 ipi_scratch[NCPU][2];
+
+// in kernelvec.S, passes IPIs on to supervisor mode.
+void machinevec();
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -40,6 +47,9 @@ start()
   // ask for clock interrupts.
   timerinit();
 
+  // let other harts interrupt this one.
+  ipiinit();
+
   // keep each CPU's hartid in its tp register, for cpuid().
   int id = r_mhartid();
   w_tp(id);
@@ -60,7 +70,22 @@ timerinit()
   
   // allow supervisor to use stimecmp and time.
   w_mcounteren(r_mcounteren() | 2);
+
+  // and user mode to read time, for uptime() in user/ulib.c.
+  w_scounteren(r_scounteren() | 2);
   
   // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(r_time() + TIMEBASE/HZ);
+}
+
+// take machine software interrupts, which the kernel
+// raises through the CLINT to send an IPI, in machinevec.
+void
+ipiinit()
+{
+  int id = r_mhartid();
+
+  w_mscratch((uint64)&ipi_scratch[id][0]);
+  w_mtvec((uint64)machinevec);
+  w_mie(r_mie() | MIE_MSIE);
 }
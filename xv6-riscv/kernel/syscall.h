@@ -23,3 +23,23 @@
 #define SYS_swapread	22
 #define SYS_swapwrite	23
 #define SYS_swapstat	24
+#define SYS_sendfile	25
+#define SYS_splice	26
+#define SYS_readv	27
+#define SYS_writev	28
+#define SYS_pread	29
+#define SYS_pwrite	30
+#define SYS_setpriority	31
+#define SYS_uptime_ns	32
+#define SYS_clone	33
+#define SYS_join	34
+#define SYS_futex_wait	35
+#define SYS_futex_wake	36
+#define SYS_lockstat	37
+#define SYS_profile	38
+#define SYS_profread	39
+#define SYS_tracectl	40
+#define SYS_traceread	41
+#define SYS_ringsetup	42
+#define SYS_ringenter	43
+#define SYS_sync	44
@@ -10,22 +10,24 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "fs.h"
-#include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return both the descriptor and the corresponding struct file,
+// which the caller must release with fdput(f, *pref).
 static int
-argfd(int n, int *pfd, struct file **pf)
+argfd(int n, int *pfd, struct file **pf, int *pref)
 {
   int fd;
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f=fdget(fd, pref)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -34,34 +36,21 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
-static int
-fdalloc(struct file *f)
-{
-  int fd;
-  struct proc *p = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
-}
-
 uint64
 sys_dup(void)
 {
   struct file *f;
-  int fd;
+  int fd, ref;
 
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, 0, &f, &ref) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  // the new descriptor needs a reference of its own.
+  if(!ref)
+    filedup(f);
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -69,29 +58,172 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r, ref;
   uint64 p;
 
   argaddr(1, &p);
   argint(2, &n);
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, 0, &f, &ref) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fdput(f, ref);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r, ref;
   uint64 p;
   
   argaddr(1, &p);
   argint(2, &n);
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, 0, &f, &ref) < 0)
+    return -1;
+
+  r = filewrite(f, p, n);
+  fdput(f, ref);
+  return r;
+}
+
+// Copy n bytes from file in_fd, starting at off (or at its
+// current offset if off is negative), to out_fd inside the kernel.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n, r, outref, inref;
+
+  argint(2, &off);
+  argint(3, &n);
+  if(argfd(0, 0, &out, &outref) < 0)
+    return -1;
+  if(argfd(1, 0, &in, &inref) < 0){
+    fdput(out, outref);
+    return -1;
+  }
+  r = -1;
+  if(in->type == FD_INODE && n >= 0)
+    r = filesplice(out, in, off, n);
+  fdput(in, inref);
+  fdput(out, outref);
+  return r;
+}
+
+// Move up to n bytes from in_fd to out_fd inside the kernel.
+// One of the two must be a pipe.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n, r, inref, outref;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in, &inref) < 0)
+    return -1;
+  if(argfd(1, 0, &out, &outref) < 0){
+    fdput(in, inref);
+    return -1;
+  }
+  r = -1;
+  if((in->type == FD_PIPE || out->type == FD_PIPE) && n >= 0)
+    r = filesplice(out, in, -1, n);
+  fdput(out, outref);
+  fdput(in, inref);
+  return r;
+}
+
+// Fetch the nth system call argument as a user array of
+// iovcnt iovecs, and copy it into iov.
+static int
+argiov(int n, int iovcnt, struct iovec *iov)
+{
+  uint64 uiov, tot;
+  int i;
+
+  argaddr(n, &uiov);
+  if(iovcnt < 0 || iovcnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, iovcnt*sizeof(*iov)) < 0)
+    return -1;
+  for(tot = 0, i = 0; i < iovcnt; i++)
+    tot += iov[i].iov_len;
+  if(tot >= (1L << 31))
+    return -1;
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int iovcnt, r, ref;
+
+  argint(2, &iovcnt);
+  if(argiov(1, iovcnt, iov) < 0 || argfd(0, 0, &f, &ref) < 0)
+    return -1;
+  r = filereadv(f, iov, iovcnt, -1);
+  fdput(f, ref);
+  return r;
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int iovcnt, r, ref;
+
+  argint(2, &iovcnt);
+  if(argiov(1, iovcnt, iov) < 0 || argfd(0, 0, &f, &ref) < 0)
+    return -1;
+  r = filewritev(f, iov, iovcnt, -1);
+  fdput(f, ref);
+  return r;
+}
+
+// Read n bytes at byte offset off without moving the file offset.
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  uint64 p;
+  int n, off, r, ref;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(n < 0 || off < 0 || argfd(0, 0, &f, &ref) < 0)
     return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  r = filereadv(f, &iov, 1, off);
+  fdput(f, ref);
+  return r;
+}
+
+// Write n bytes at byte offset off without moving the file offset.
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  uint64 p;
+  int n, off, r, ref;
 
-  return filewrite(f, p, n);
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(n < 0 || off < 0 || argfd(0, 0, &f, &ref) < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  r = filewritev(f, &iov, 1, off);
+  fdput(f, ref);
+  return r;
 }
 
 uint64
@@ -100,9 +232,9 @@ sys_close(void)
   int fd;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  argint(0, &fd);
+  if((f = fdtake(fd)) == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -112,11 +244,14 @@ sys_fstat(void)
 {
   struct file *f;
   uint64 st; // user pointer to struct stat
+  int r, ref;
 
   argaddr(1, &st);
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, 0, &f, &ref) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fdput(f, ref);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -301,18 +436,14 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode, for sys_open() and the
+// system call ring. Returns the new fd, or -1.
+int
+fileopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -370,6 +501,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return fileopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -411,7 +554,6 @@ sys_chdir(void)
 {
   char path[MAXPATH];
   struct inode *ip;
-  struct proc *p = myproc();
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -425,9 +567,8 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  iput(cwdswap(ip));
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
@@ -488,15 +629,15 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdtake(fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdtake(fd0);
+    fdtake(fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -504,6 +645,16 @@ sys_pipe(void)
   return 0;
 }
 
+// Write the dirty pages of all files in use to disk.
+uint64
+sys_sync(void)
+{
+  begin_op();
+  isync();
+  end_op();
+  return 0;
+}
+
 // pa4: swap functions sysfile
 uint64 
 sys_swapread(void)
@@ -4,6 +4,8 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rwlock.h"
 #include "proc.h"
 
 uint64
@@ -38,14 +40,10 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  uint64 addr;
   int n;
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
@@ -57,16 +55,18 @@ sys_sleep(void)
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
+  clockupdate();
+  acquire(&tickslock.lock);
   ticks0 = ticks;
   while(ticks - ticks0 < n){
     if(killed(myproc())){
-      release(&tickslock);
+      release(&tickslock.lock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    wakeat(ticks0 + n);
+    sleep(&ticks, &tickslock.lock);
   }
-  release(&tickslock);
+  release(&tickslock.lock);
   return 0;
 }
 
@@ -79,15 +79,138 @@ sys_kill(void)
   return kill(pid);
 }
 
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return setpriority(pid, nice);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
+  clockupdate();
+  return readticks();
+}
+
+// return nanoseconds since boot, read from the time CSR.
+uint64
+sys_uptime_ns(void)
+{
+  return uptimens();
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  argint(0, &tid);
+  argaddr(1, &p);
+  return join(tid, p);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futex_wait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futex_wake(addr, n);
+}
+
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return lockstat(addr, n);
+}
+
+uint64
+sys_profile(void)
+{
+  int on;
+
+  argint(0, &on);
+  return profile(on);
+}
+
+uint64
+sys_profread(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return profread(addr, n);
+}
+
+uint64
+sys_tracectl(void)
+{
+  int mask;
+
+  argint(0, &mask);
+  return tracectl(mask);
+}
+
+uint64
+sys_traceread(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return traceread(addr, n);
+}
+
+uint64
+sys_ringsetup(void)
+{
+  return ringsetup();
+}
+
+uint64
+sys_ringenter(void)
+{
+  int flags;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  argint(0, &flags);
+  return ringenter(flags);
 }
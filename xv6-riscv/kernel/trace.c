@@ -0,0 +1,115 @@
+// Kernel event tracing.
+//
+// trace(ev, a0, a1) appends a timestamped record to this CPU's
+// ring if event ev is enabled, and costs one load and branch
+// if it is not. Only the CPU itself writes its ring, with
+// interrupts off, so recording takes no locks and trace()
+// can be used anywhere, even with spinlocks held.
+//
+// traceread() drains the rings. A full ring drops new events,
+// and counts them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "trace.h"
+#include "defs.h"
+
+#define NTRACE      512  // events each CPU can hold
+#define NTRACEBATCH 16   // events copied out at a time
+
+// r is written only by readers, holding tracelock, and w
+// only by the ring's CPU; each publishes with a fence.
+struct tracering {
+  struct traceevent ev[NTRACE];
+  uint r, w;               // events read and written so far
+  uint dropped;
+} tracering[NCPU];
+
+uint tracemask;            // enabled events, 1 << TR_*
+struct sleeplock tracelock;
+
+void
+traceinit(void)
+{
+  initsleeplock(&tracelock, "trace");
+}
+
+void
+tracerecord(int ev, uint64 a0, uint64 a1)
+{
+  struct tracering *tr;
+  struct traceevent *e;
+  struct proc *p;
+  uint w;
+
+  push_off();
+  tr = &tracering[cpuid()];
+  w = tr->w;
+  if(w - __atomic_load_n(&tr->r, __ATOMIC_ACQUIRE) == NTRACE){
+    __atomic_fetch_add(&tr->dropped, 1, __ATOMIC_RELAXED);
+  } else {
+    e = &tr->ev[w % NTRACE];
+    e->time = r_time();
+    e->event = ev;
+    e->cpu = cpuid();
+    p = mycpu()->proc;
+    e->pid = p ? p->pid : 0;
+    e->arg[0] = a0;
+    e->arg[1] = a1;
+    __atomic_store_n(&tr->w, w + 1, __ATOMIC_RELEASE);
+  }
+  pop_off();
+}
+
+// Enable the events in mask, 1 << TR_*, and disable the rest.
+// Returns the number of events dropped for want of room
+// since the last call.
+int
+tracectl(uint mask)
+{
+  struct tracering *tr;
+  int dropped = 0;
+
+  __atomic_store_n(&tracemask, mask, __ATOMIC_RELAXED);
+  for(tr = tracering; tr < &tracering[NCPU]; tr++)
+    dropped += __atomic_exchange_n(&tr->dropped, 0, __ATOMIC_RELAXED);
+  return dropped;
+}
+
+// Move up to n events to the user array of struct
+// traceevent at addr, each CPU's in the order they happened.
+// Returns the number moved, or -1.
+int
+traceread(uint64 addr, int n)
+{
+  struct traceevent ev[NTRACEBATCH];
+  struct tracering *tr;
+  uint r, w;
+  int k, got = 0;
+
+  acquiresleep(&tracelock);
+  for(tr = tracering; tr < &tracering[NCPU]; tr++){
+    for(;;){
+      r = tr->r;
+      w = __atomic_load_n(&tr->w, __ATOMIC_ACQUIRE);
+      for(k = 0; k < NTRACEBATCH && got + k < n && r != w; k++)
+        ev[k] = tr->ev[r++ % NTRACE];
+      if(k == 0)
+        break;
+      // let the CPU reuse the slots.
+      __atomic_store_n(&tr->r, r, __ATOMIC_RELEASE);
+      if(copyout(myproc()->pagetable, addr + got*sizeof(ev[0]), (char*)ev, k*sizeof(ev[0])) < 0){
+        releasesleep(&tracelock);
+        return -1;
+      }
+      got += k;
+    }
+  }
+  releasesleep(&tracelock);
+  return got;
+}
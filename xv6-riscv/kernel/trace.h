@@ -0,0 +1,25 @@
+// Kernel trace events, read with traceread().
+// Both the kernel and user programs use this header file.
+
+// Event IDs, and what their arguments hold.
+#define TR_KALLOC    0  // pa, where from: 0 free list, 1 slabs, 2 file cache, 3 swap
+#define TR_SWAPOUT   1  // pa, user va
+#define TR_SWAPIN    2  // user va, pa
+#define TR_BREAD     3  // block, 1 if it was cached
+#define TR_BWRITE    4  // block
+#define TR_DISK      5  // block, 1 if a write: request sent to disk
+#define TR_DISKDONE  6  // block: request finished
+#define TR_SLEEP     7  // channel
+#define TR_WAKEUP    8  // channel, processes woken
+#define TR_SWITCH    9  // priority level: scheduler runs the event's pid
+#define NTREVENT     10
+
+#define TR_ALL ((1 << NTREVENT) - 1)
+
+struct traceevent {
+  uint64 time;     // time CSR (TIMEBASE per second)
+  ushort event;    // TR_*
+  ushort cpu;
+  int pid;         // process running, or 0 if none
+  uint64 arg[2];
+};
@@ -3,11 +3,24 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "rwlock.h"
 #include "proc.h"
+#include "prof.h"
 #include "defs.h"
 
-struct spinlock tickslock;
+// The clock is tickless: ticks is computed from the time
+// CSR whenever some hart takes a timer interrupt. A hart
+// running a process interrupts itself every tick, to charge
+// the process's time slice; an idle hart only wakes for the
+// next sleep() deadline, or when another hart sends it an IPI.
+#define TICKINTERVAL (TIMEBASE/HZ)
+#define PROFINTERVAL (TIMEBASE/PROFHZ)
+
+struct seqlock tickslock;  // readers of ticks need not lock
 uint ticks;
+uint64 boottime;     // time CSR at boot
+uint tickwake = -1;  // earliest tick a sleeper waits for (tickslock.lock)
 
 extern char trampoline[], uservec[], userret[];
 
@@ -19,7 +32,9 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+  initseqlock(&tickslock, "time");
+  addwchan("ticks", &ticks, sizeof(ticks));
+  boottime = r_time();
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -27,6 +42,7 @@ void
 trapinithart(void)
 {
   w_stvec((uint64)kernelvec);
+  settimer(r_time() + TICKINTERVAL);
 }
 
 //
@@ -45,6 +61,11 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // the trampoline has flushed this CPU's user TLB entries.
+  struct cpu *c = mycpu();
+  c->upagetable = 0;
+  c->nutrap++;
+
   struct proc *p = myproc();
   
   // save user program counter.
@@ -70,25 +91,27 @@ usertrap(void)
   } else if(r_scause() == 13 || r_scause() == 15 || r_scause() == 12){
     // Page Fault (12: Instruction, 13: Load, 15: Store)
     uint64 va = r_stval();
-    uint64 pa;
-    uint flags;
-    char *mem;
     pte_t *pte;
     struct proc *p = myproc();
 
     // 1. Check if the virtual address is valid
     // It must be within the process size and not in the guard page
-    if(va >= p->sz || (va < PGROUNDDOWN(p->trapframe->sp) && va >= PGROUNDDOWN(p->trapframe->sp) - PGSIZE))
+    // (a thread's stack has none)
+    if(va >= p->tg->sz || (!p->thread && va < PGROUNDDOWN(p->trapframe->sp) && va >= PGROUNDDOWN(p->trapframe->sp) - PGSIZE))
     {
       setkilled(p);
       exit(-1);
     }
 
+    // keep other threads from swapping the page in too.
+    vmlock();
+
     // 2. Find the PTE
     // walk() returns the PTE address. 0 means allocate=0 (don't create new tables)
     if((pte = walk(p->pagetable, va, 0)) == 0)
     {
       // Segmentation fault: Accessing unmapped address
+      vmunlock();
       setkilled(p);
       exit(-1);
     }
@@ -97,51 +120,37 @@ usertrap(void)
     // It must be Invalid (PTE_V is 0) and Swapped (PTE_S is 1)
     if((*pte & PTE_V) == 0 && (*pte & PTE_S))
     {
-      // 4. Allocate a new physical page
-      if((mem = kalloc()) == 0)
+      // 4-9. Read the page back from swap space
+      if(uvmswapin(p->pagetable, va, pte) < 0)
       {
         // Out of memory
+        vmunlock();
         setkilled(p);
         exit(-1);
       }
-      pa = (uint64)mem;
-
-      // 5. Swap In operation
-      // Extract swap index from PPN field (top 54 bits)
-      uint swap_idx = (*pte) >> 10;
-      
-      // Read from swap space
-      swapread(pa, swap_idx, 0);
-
-      // 6. Free the swap space in bitmap
-      acquire(&swap_lock);
-      swap_bitmap[swap_idx] = 0;
-      release(&swap_lock);
-
-      // 7. Restore PTE
-      // Retrieve original flags (bottom 10 bits) but turn off PTE_S and turn on PTE_V
-      flags = PTE_FLAGS(*pte);
-      flags &= ~PTE_S; // Clear Swapped bit
-      flags |= PTE_V;  // Set Valid bit
-
-      // Update the PTE with the new physical address and flags
-      *pte = PA2PTE(pa) | flags;
-
-      pages[pa/PGSIZE].pagetable = p->pagetable;
-      pages[pa/PGSIZE].vaddr = (char*)PGROUNDDOWN(va);
-
-      // 8. Add to LRU list
-      // Since we updated PTE manually (not via mappages), we must call lru_add manually
-      lru_add(pa);
-
-      // 9. Flush TLB
-      sfence_vma();
-    } 
+    }
+    else if(r_scause() == 15 && (*pte & PTE_V) && (*pte & PTE_C))
+    {
+      // Store to a page lent to a pipe: copy it before writing.
+      if(uvmcow(p->pagetable, va) < 0)
+      {
+        vmunlock();
+        setkilled(p);
+        exit(-1);
+      }
+    }
+    else if((*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) &&
+            (*pte & (r_scause() == 15 ? PTE_W : r_scause() == 12 ? PTE_X : PTE_R)))
+    {
+      // another thread swapped the page in first; retry.
+    }
     else 
     {
+      vmunlock();
       setkilled(p);
       exit(-1);
     }
+    vmunlock();
   } else { 
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -151,9 +160,9 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // charge the time slice if this is a timer interrupt.
   if(which_dev == 2)
-    yield();
+    schedtick();
 
   usertrapret();
 }
@@ -197,11 +206,17 @@ usertrapret(void)
   // tell trampoline.S the user page table to switch to.
   uint64 satp = MAKE_SATP(p->pagetable);
 
+  // from now until the next trap, tlbflush() must ask
+  // this CPU to flush entries for p's page table.
+  mycpu()->upagetable = p->pagetable;
+  __sync_synchronize();
+
   // jump to userret in trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
+  // switches to the user page table, restores user registers
+  // from the trapframe at p->tfva, and switches to user mode
+  // with sret.
   uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  ((void (*)(uint64, uint64))trampoline_userret)(satp, p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -225,35 +240,195 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // charge the time slice if this is a timer interrupt.
   if(which_dev == 2 && myproc() != 0)
-    yield();
+    schedtick();
 
-  // the yield() may have caused some traps to occur,
+  // the schedtick() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
 }
 
+// Ask for a timer interrupt on this hart at time t.
+// Writing stimecmp also clears a pending timer interrupt.
 void
-clockintr()
+settimer(uint64 t)
+{
+  push_off();
+  mycpu()->timer = t;
+  w_stimecmp(t);
+  pop_off();
+}
+
+// When a hart running a process should next take a timer
+// interrupt: at its next tick, or sooner to take a sample.
+static uint64
+runtimer(struct cpu *c, uint64 now)
+{
+  if(profiling && now + PROFINTERVAL < c->ticknext)
+    return now + PROFINTERVAL;
+  return c->ticknext;
+}
+
+// Make sure this hart, about to run a process, charges it a
+// tick within a tick. Interrupts must be disabled.
+void
+timerrun(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now = r_time(), t;
+
+  if(c->ticknext <= now || c->ticknext > now + TICKINTERVAL)
+    c->ticknext = now + TICKINTERVAL;
+  t = runtimer(c, now);
+  if(c->timer > t)
+    settimer(t);
+}
+
+// Set this idle hart's timer for the next sleep() deadline,
+// or turn it off if no process is sleeping on the clock.
+void
+timeridle(void)
+{
+  uint64 t = -1;
+
+  acquire(&tickslock.lock);
+  if(tickwake != (uint)-1)
+    t = boottime + (uint64)tickwake * TICKINTERVAL;
+  release(&tickslock.lock);
+  settimer(t);
+}
+
+// Bring ticks up to date with the time CSR, waking any
+// sleepers whose deadline has passed.
+void
+clockupdate(void)
 {
-  if(cpuid() == 0){
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
+  uint now = (r_time() - boottime) / TICKINTERVAL;
+
+  // every hart's timer interrupt gets here, but most find
+  // ticks already up to date, so look before locking.
+  if((int)(now - readticks()) <= 0)
+    return;
+
+  acquire(&tickslock.lock);
+  if((int)(now - ticks) > 0){
+    if(now / BOOSTTICKS != ticks / BOOSTTICKS)
+      schedboost();
+    writeseqbegin(&tickslock);
+    ticks = now;
+    writeseqend(&tickslock);
+    vdataupdate(now);
+    if(ticks >= tickwake){
+      tickwake = -1;
+      wakeup(&ticks);
+    }
   }
+  release(&tickslock.lock);
+}
+
+// Return ticks, without taking tickslock.lock.
+uint
+readticks(void)
+{
+  uint seq, t;
 
-  // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  do {
+    seq = readseqbegin(&tickslock);
+    t = ticks;
+  } while(readseqretry(&tickslock, seq));
+  return t;
+}
+
+// Ask clockupdate() to wake the clock's sleepers at tick t.
+// Caller must hold tickslock.lock.
+void
+wakeat(uint t)
+{
+  if(t < tickwake)
+    tickwake = t;
+}
+
+// Nanoseconds since boot, from the time CSR.
+uint64
+uptimens(void)
+{
+  return (r_time() - boottime) * (1000000000L / TIMEBASE);
+}
+
+// Send an inter-processor interrupt to the given hart,
+// to make an idle scheduler() look at the run queues.
+void
+sendipi(int hart)
+{
+  *(volatile uint32*)CLINT_MSIP(hart) = 1;
+}
+
+// Make sure no CPU uses stale TLB entries for pagetable,
+// after a change that takes away access to a page.
+// A CPU only holds user TLB entries while in user space,
+// since the trampoline flushes them on every trap, so send
+// an IPI to the CPUs running pagetable in user space and
+// wait until each has trapped into the kernel. A CPU in
+// user space holds no kernel locks and takes interrupts, so
+// the caller may hold locks.
+void
+tlbflush(pagetable_t pagetable)
+{
+  uint seen[NCPU];
+  int i, id, wait;
+
+  sfence_vma();
+  push_off();
+  id = cpuid();
+  __sync_synchronize();
+  wait = 0;
+  for(i = 0; i < NCPU; i++){
+    seen[i] = cpus[i].nutrap;
+    __sync_synchronize();
+    if(i != id && cpus[i].upagetable == pagetable){
+      sendipi(i);
+      wait |= 1 << i;
+    }
+  }
+  for(i = 0; i < NCPU; i++){
+    if(wait & (1 << i)){
+      while(cpus[i].upagetable == pagetable && cpus[i].nutrap == seen[i])
+        __sync_synchronize();
+    }
+  }
+  pop_off();
+}
+
+// Returns whether a tick is due, to charge to the running
+// process's time slice, rather than only a sample.
+int
+clockintr()
+{
+  struct cpu *c = mycpu();
+  uint64 now = r_time();
+  int tick;
+
+  clockupdate();
+
+  tick = now >= c->ticknext;
+  if(tick)
+    c->ticknext = now + TICKINTERVAL;
+
+  // ask for the next timer interrupt: at the next tick if a
+  // process is running, to charge its time slice. an idle
+  // hart's scheduler() sets its own timer before wfi.
+  if(myproc() != 0)
+    settimer(runtimer(c, now));
+  else
+    settimer(-1);
+  return tick;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
+// returns 2 if a clock tick (see clockintr()),
 // 1 if other device,
 // 0 if not recognized.
 int
@@ -283,9 +458,15 @@ devintr()
 
     return 1;
   } else if(scause == 0x8000000000000005L){
-    // timer interrupt.
-    clockintr();
-    return 2;
+    // timer interrupt: a tick, or just a profiling sample.
+    if(profiling)
+      profsample(r_sepc(), (r_sstatus() & SSTATUS_SPP) == 0);
+    return clockintr() ? 2 : 1;
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt: an IPI passed on by machinevec.
+    // it only needs to wake this hart from wfi.
+    w_sip(r_sip() & ~SIP_SSIP);
+    return 1;
   } else {
     return 0;
   }
@@ -0,0 +1,9 @@
+// Scatter/gather buffers for readv() and writev().
+// Both the kernel and user programs use this header file.
+
+#define IOV_MAX 16  // most buffers in one readv() or writev()
+
+struct iovec {
+  void *iov_base;   // start of buffer
+  uint iov_len;     // size of buffer in bytes
+};
@@ -0,0 +1,57 @@
+//
+// The kernel's read-only data page (see vdata.h), shared by
+// every process so that user code can find the time and a few
+// counters without a system call; user/ulib.c's uptime() and
+// uptime_ns() read it. A single page for all processes costs
+// the clock one copy per tick; per-process values such as the
+// pid, which here belong to each thread of an address space,
+// are left to system calls.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "defs.h"
+#include "vdata.h"
+
+extern uint64 boottime;           // trap.c
+extern int lru_npages, file_npages; // kalloc.c
+
+struct vdata *vdata;
+
+void
+vdatainit(void)
+{
+  if((vdata = (struct vdata*)kalloc()) == 0)
+    panic("vdatainit");
+  memset(vdata, 0, PGSIZE);
+  vdata->boottime = boottime;
+  vdata->timebase = TIMEBASE;
+  vdata->tickinterval = TIMEBASE/HZ;
+}
+
+// Called by clockupdate() when ticks moves to t.
+void
+vdataupdate(uint t)
+{
+  if(vdata == 0)
+    return;
+  vdata->ticks = t;
+  vdata->sectorsread = nr_sectors_read;
+  vdata->sectorswritten = nr_sectors_write;
+  vdata->lrupages = lru_npages;
+  vdata->filepages = file_npages;
+}
+
+// Map the page read-only at VDATA in a new page table.
+// It is never on the LRU list, so it is never swapped out.
+int
+vdatamap(pagetable_t pagetable)
+{
+  return mapkpage(pagetable, VDATA, (uint64)vdata, PTE_R | PTE_U);
+}
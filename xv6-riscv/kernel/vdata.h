@@ -0,0 +1,15 @@
+// The kernel's read-only data page, mapped at VDATA in every
+// process. User mode may read the time CSR itself, so the page
+// holds what turns a time reading into ticks or nanoseconds;
+// the other fields are copied in on every clock tick.
+
+struct vdata {
+  uint64 boottime;      // time CSR at tick 0
+  uint64 timebase;      // time CSR counts per second
+  uint64 tickinterval;  // time CSR counts per tick
+  uint ticks;           // as of the last tick
+  int sectorsread;      // swap sectors read, as swapstat()
+  int sectorswritten;   // swap sectors written
+  int lrupages;         // user pages that swap_out() may take
+  int filepages;        // page cache pages
+};
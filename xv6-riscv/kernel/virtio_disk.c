@@ -7,6 +7,7 @@
 
 #include "types.h"
 #include "riscv.h"
+#include "trace.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
@@ -64,6 +65,7 @@ virtio_disk_init(void)
   uint32 status = 0;
 
   initlock(&disk.vdisk_lock, "virtio_disk");
+  addwchan("disk", &disk, sizeof(disk));
 
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 2 ||
@@ -217,6 +219,7 @@ virtio_disk_rw(struct buf *b, int write)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
+  trace(TR_DISK, b->blockno, write);
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
@@ -317,6 +320,7 @@ virtio_disk_intr()
       panic("virtio_disk_intr status");
 
     struct buf *b = disk.info[id].b;
+    trace(TR_DISKDONE, b->blockno, 0);
     b->disk = 0;   // disk is done with buf
     wakeup(b);
 
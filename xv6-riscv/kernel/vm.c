@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "trace.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -30,6 +31,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT software interrupt bits, for IPIs
+  kvmmap(kpgtbl, CLINT, CLINT, PGSIZE, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
@@ -177,6 +181,35 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Map the kernel-owned page at pa at user address va, keeping
+// it off the LRU list so that swap_out() never picks it: the
+// kernel reaches it by its physical address and frees it itself.
+// Returns 0, or -1 if walk() couldn't allocate a page-table page.
+int
+mapkpage(pagetable_t pagetable, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+
+  if((pte = walk(pagetable, va, 1)) == 0)
+    return -1;
+  if(*pte & PTE_V)
+    panic("mapkpage: remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
+}
+
+// Free the pages gathered by uvmunmap(), once no CPU can
+// still reach them through its TLB.
+static void
+freegathered(pagetable_t pagetable, uint64 *pa, int n)
+{
+  if(n == 0)
+    return;
+  tlbflush(pagetable);
+  while(n > 0)
+    kfree((void*)pa[--n]);
+}
+
 // Remove npages of mappings starting from va. va must be
 // page-aligned. The mappings must exist.
 // Optionally free the physical memory.
@@ -185,6 +218,8 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  uint64 gather[32];  // pages to free after the TLB flush
+  int n = 0;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
@@ -217,10 +252,15 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       uint64 pa = PTE2PA(*pte);
       // Remove from LRU when page is released
       lru_remove(pa);
-      kfree((void*)pa);
+      if(n == NELEM(gather)){
+        freegathered(pagetable, gather, n);
+        n = 0;
+      }
+      gather[n++] = pa;
     }
     *pte = 0;
   }
+  freegathered(pagetable, gather, n);
 }
 
 // create an empty user page table.
@@ -383,7 +423,9 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
             // 6. Copy data from Parent to Child
             memmove(mem, parent_mem, PGSIZE);
             
-            // 7. Map Child Page
+            // 7. Map Child Page (the child's copy is never lent out)
+            if(flags & PTE_C)
+              flags = (flags & ~PTE_C) | PTE_W;
             if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
               kfree(mem);
               goto err;
@@ -402,6 +444,8 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
     // Case 2: Normal Page (In Memory)
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
+    if(flags & PTE_C)
+      flags = (flags & ~PTE_C) | PTE_W;
     
     if((mem = kalloc()) == 0)
       goto err;
@@ -433,6 +477,189 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// Lend the user page at va to a pipe without copying it.
+// Takes an extra reference on the physical page, which also
+// keeps swap_out() from evicting it, and if the page was
+// writable makes it copy-on-write so the owner cannot change
+// data the pipe has not delivered yet.
+// Returns 0 and stores the physical address in *pap, or -1.
+int
+uvmloan(pagetable_t pagetable, uint64 va, uint64 *pap)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(va >= MAXVA)
+    return -1;
+
+  // lru_lock keeps swap_out() from picking the page while we pin it.
+  acquire(&lru_lock);
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0){
+    release(&lru_lock);
+    return -1;
+  }
+  pa = PTE2PA(*pte);
+  pages[pa / PGSIZE].refcnt++;
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_C;
+  release(&lru_lock);
+
+  tlbflush(pagetable);
+  *pap = pa;
+  return 0;
+}
+
+// Resolve a write to a copy-on-write page at va.
+// If the pipe is done with the page it simply becomes writable
+// again; otherwise the owner gets a private copy and the pipe
+// keeps the original.
+// Returns 0 on success (the caller should retry the access),
+// -1 if out of memory.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte, old;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+
+  acquire(&lru_lock);
+  old = *pte;
+  if((old & (PTE_V|PTE_C)) != (PTE_V|PTE_C)){
+    release(&lru_lock);
+    return 0;
+  }
+  pa = PTE2PA(old);
+  flags = (PTE_FLAGS(old) & ~PTE_C) | PTE_W;
+  if(pages[pa / PGSIZE].refcnt == 1){
+    // no longer lent; take it back.
+    *pte = PA2PTE(pa) | flags;
+    release(&lru_lock);
+    sfence_vma();
+    return 0;
+  }
+  release(&lru_lock);
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+
+  // Take the page off the LRU first; once it is off, swap_out()
+  // cannot touch our PTE, so the check below stays valid.
+  lru_remove(pa);
+  acquire(&lru_lock);
+  if(*pte != old){
+    // swapped out while we were allocating; fault again.
+    release(&lru_lock);
+    kfree(mem);
+    return 0;
+  }
+  if(pages[pa / PGSIZE].refcnt == 1){
+    *pte = PA2PTE(pa) | flags;
+    release(&lru_lock);
+    kfree(mem);
+    lru_add(pa);
+  } else {
+    pages[pa / PGSIZE].refcnt--;  // the pipe's reference remains
+    *pte = PA2PTE((uint64)mem) | flags;
+    release(&lru_lock);
+    pages[(uint64)mem / PGSIZE].pagetable = pagetable;
+    pages[(uint64)mem / PGSIZE].vaddr = (char*)va;
+    lru_add((uint64)mem);
+  }
+  tlbflush(pagetable);
+  return 0;
+}
+
+// Read the swapped-out user page at va, whose PTE is pte,
+// back into memory.
+// The caller holds the process's vmlock.
+// Returns 0, or -1 if out of memory.
+int
+uvmswapin(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  uint64 pa;
+  uint flags;
+  char *mem;
+  uint swap_idx;
+
+  // Allocate a new physical page
+  if((mem = kalloc()) == 0)
+    return -1;
+  pa = (uint64)mem;
+  trace(TR_SWAPIN, PGROUNDDOWN(va), pa);
+
+  // Swap In operation
+  // Extract swap index from PPN field (top 54 bits)
+  swap_idx = (*pte) >> 10;
+  swapread(pa, swap_idx, 0);
+
+  // Free the swap space in bitmap
+  acquire(&swap_lock);
+  swap_bitmap[swap_idx] = 0;
+  release(&swap_lock);
+
+  // Restore PTE: original flags, but not swapped and valid
+  flags = PTE_FLAGS(*pte);
+  flags &= ~PTE_S;
+  flags |= PTE_V;
+  *pte = PA2PTE(pa) | flags;
+
+  pages[pa/PGSIZE].pagetable = pagetable;
+  pages[pa/PGSIZE].vaddr = (char*)PGROUNDDOWN(va);
+
+  // Since we updated PTE manually (not via mappages), we must call lru_add manually
+  lru_add(pa);
+  sfence_vma();
+  return 0;
+}
+
+// Return the physical address of the writable user
+// address va, swapping its page in or copying it from a
+// pipe's loan first if need be, and take a reference on
+// the page so that it stays at that address until kfree().
+// The caller holds the process's vmlock.
+// Returns 0 if va is not a writable user address.
+uint64
+uvmpin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(va >= MAXVA || (pte = walk(pagetable, va, 0)) == 0)
+    return 0;
+  for(;;){
+    if((*pte & PTE_V) == 0 && (*pte & PTE_S)){
+      if(uvmswapin(pagetable, va, pte) < 0)
+        return 0;
+    } else if((*pte & (PTE_V|PTE_C)) == (PTE_V|PTE_C)){
+      if(uvmcow(pagetable, va) < 0)
+        return 0;
+    }
+
+    // swap_out() may have taken the page again.
+    acquire(&lru_lock);
+    if((*pte & (PTE_V|PTE_U|PTE_W)) == (PTE_V|PTE_U|PTE_W))
+      break;
+    if((*pte & PTE_V) && (*pte & PTE_C) == 0){
+      release(&lru_lock);
+      return 0;
+    }
+    release(&lru_lock);
+    if((*pte & (PTE_V|PTE_S)) == 0)
+      return 0;
+  }
+  pa = PTE2PA(*pte);
+  pages[pa / PGSIZE].refcnt++;
+  release(&lru_lock);
+  return pa + (va - PGROUNDDOWN(va));
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -447,6 +674,11 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     if(va0 >= MAXVA)
       return -1;
     pte = walk(pagetable, va0, 0);
+    // a page lent to a pipe needs its own copy before we write it.
+    while(pte && (*pte & (PTE_V|PTE_C)) == (PTE_V|PTE_C)){
+      if(uvmcow(pagetable, va0) < 0)
+        return -1;
+    }
     if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
        (*pte & PTE_W) == 0)
       return -1;
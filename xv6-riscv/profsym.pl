@@ -0,0 +1,62 @@
+#!/usr/bin/perl -w
+
+# Turn the output of xv6's prof program, captured from the
+# console, into a profile by function, using the symbol tables
+# the Makefile writes next to the kernel and user programs.
+#
+#   perl profsym.pl kernel/kernel.sym [user/_prog.sym] < prof.out
+
+use strict;
+
+die "usage: profsym.pl kernel.sym [user.sym] < prof.out\n"
+    if @ARGV < 1 || @ARGV > 2;
+
+# Read a .sym file: "address name" per line. Returns a list of
+# [address, name] sorted by address.
+sub loadsym {
+    my ($file) = @_;
+    my @syms;
+
+    open(my $fh, "<", $file) or die "profsym.pl: $file: $!\n";
+    while(<$fh>){
+        my ($addr, $name) = split;
+        next unless defined $name && $addr =~ /^[0-9a-f]+$/i;
+        push @syms, [hex($addr), $name];
+    }
+    close($fh);
+    return [sort { $a->[0] <=> $b->[0] } @syms];
+}
+
+# The name of the last symbol at or below pc.
+sub lookup {
+    my ($syms, $pc) = @_;
+    my ($lo, $hi) = (0, scalar(@$syms) - 1);
+
+    return sprintf("0x%x", $pc) if $hi < 0 || $pc < $syms->[0][0];
+    while($lo < $hi){
+        my $mid = int(($lo + $hi + 1) / 2);
+        if($syms->[$mid][0] <= $pc){
+            $lo = $mid;
+        } else {
+            $hi = $mid - 1;
+        }
+    }
+    return $syms->[$lo][1];
+}
+
+my $ksyms = loadsym($ARGV[0]);
+my $usyms = @ARGV > 1 ? loadsym($ARGV[1]) : [];
+my (%count, $total);
+
+while(<STDIN>){
+    my ($n, $mode, $pc) = /^(\d+)\s+([ku])\s+0x([0-9a-f]+)/i or next;
+    my $name = $mode eq "k" ? lookup($ksyms, hex($pc))
+                            : "user:" . lookup($usyms, hex($pc));
+    $count{$name} += $n;
+    $total += $n;
+}
+die "profsym.pl: no samples\n" unless $total;
+
+foreach my $name (sort { $count{$b} <=> $count{$a} } keys %count){
+    printf("%6d %5.1f%%  %s\n", $count{$name}, 100 * $count{$name} / $total, $name);
+}
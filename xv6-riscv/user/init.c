@@ -1,5 +1,6 @@
 // init: The initial user-level program
 
+#include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/spinlock.h"
@@ -11,6 +12,9 @@
 
 char *argv[] = { "sh", 0 };
 
+// seconds between writes of dirty file pages to disk.
+#define SYNCSECS 5
+
 int
 main(void)
 {
@@ -23,6 +27,20 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // start the update process, which writes dirty
+  // file pages to disk every SYNCSECS seconds.
+  pid = fork();
+  if(pid < 0){
+    printf("init: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(;;){
+      sleep(SYNCSECS*HZ);
+      sync();
+    }
+  }
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
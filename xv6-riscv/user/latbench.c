@@ -0,0 +1,100 @@
+// Interactive latency benchmark.
+// Two processes bounce a byte over a pair of pipes, as an
+// interactive program trades keystrokes with the shell, while
+// CPU-bound children spin in the background. Reports how many
+// round trips complete in a fixed number of ticks, first alone
+// and then under load.
+//
+//   latbench [nhogs] [hognice] [ticks]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MAXHOGS 16
+
+// Count round trips completed in the given number of ticks.
+int
+pingpong(int nticks)
+{
+  int to[2], from[2], pid, n, t0;
+  char c = 'x';
+
+  if(pipe(to) < 0 || pipe(from) < 0){
+    fprintf(2, "latbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "latbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(to[1]);
+    close(from[0]);
+    while(read(to[0], &c, 1) == 1)
+      write(from[1], &c, 1);
+    exit(0);
+  }
+  close(to[0]);
+  close(from[1]);
+
+  t0 = uptime();
+  for(n = 0; uptime() - t0 < nticks; n++){
+    if(write(to[1], &c, 1) != 1 || read(from[0], &c, 1) != 1){
+      fprintf(2, "latbench: pipe broke\n");
+      exit(1);
+    }
+  }
+  close(to[1]);
+  close(from[0]);
+  wait(0);
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nhogs = 4, hognice = 0, nticks = 50;
+  int pids[MAXHOGS];
+  int i, idle, busy;
+  volatile int spin = 0;
+
+  if(argc > 1)
+    nhogs = atoi(argv[1]);
+  if(argc > 2)
+    hognice = atoi(argv[2]);
+  if(argc > 3)
+    nticks = atoi(argv[3]);
+  if(nhogs < 0 || nhogs > MAXHOGS){
+    fprintf(2, "latbench: nhogs must be 0..%d\n", MAXHOGS);
+    exit(1);
+  }
+
+  idle = pingpong(nticks);
+
+  for(i = 0; i < nhogs; i++){
+    pids[i] = fork();
+    if(pids[i] < 0){
+      fprintf(2, "latbench: fork failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0){
+      if(setpriority(0, hognice) < 0)
+        fprintf(2, "latbench: bad nice level %d\n", hognice);
+      for(;;)
+        spin++;
+    }
+  }
+
+  busy = pingpong(nticks);
+
+  for(i = 0; i < nhogs; i++){
+    kill(pids[i]);
+    wait(0);
+  }
+
+  printf("latbench: %d ticks: %d round trips alone, %d with %d hogs at nice %d\n",
+         nticks, idle, busy, nhogs, hognice);
+  exit(0);
+}
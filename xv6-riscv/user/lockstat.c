@@ -0,0 +1,74 @@
+// List the most contended kernel locks.
+// With a command, counts only while the command runs.
+//
+//   lockstat [-n count] [command args...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct lockstat ls[NLOCKCLASS];
+
+// Waits on the lock, spinning or sleeping.
+uint64
+contention(struct lockstat *l)
+{
+  return l->ncontended + l->nsleepwait;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat t;
+  int i, j, n, pid, show = 10;
+
+  argv++;
+  argc--;
+  if(argc >= 2 && strcmp(argv[0], "-n") == 0){
+    show = atoi(argv[1]);
+    argv += 2;
+    argc -= 2;
+  }
+
+  if(argc > 0){
+    lockstat(0, 0);
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[0], argv);
+      fprintf(2, "lockstat: exec %s failed\n", argv[0]);
+      exit(1);
+    }
+    wait(0);
+  }
+
+  if((n = lockstat(ls, NLOCKCLASS)) < 0){
+    fprintf(2, "lockstat: lockstat failed\n");
+    exit(1);
+  }
+
+  // most contended first.
+  for(i = 1; i < n; i++){
+    t = ls[i];
+    for(j = i; j > 0 && contention(&ls[j-1]) < contention(&t); j--)
+      ls[j] = ls[j-1];
+    ls[j] = t;
+  }
+
+  // for sleeplocks, also how often a waiter got the lock
+  // by spinning rather than sleeping.
+  printf("%s\t%s\t%s\t%s\t%s\n", "lock", "acquires", "contended",
+         "spin(us)", "sleepwait/spinok");
+  for(i = 0; i < n && i < show; i++){
+    printf("%s\t%ld\t%ld\t%ld", ls[i].name, ls[i].nacquire,
+           ls[i].ncontended, ls[i].spinns / 1000);
+    if(ls[i].nsleepwait)
+      printf("\t%ld/%ld", ls[i].nsleepwait, ls[i].nspinok);
+    printf("\n");
+  }
+  exit(0);
+}
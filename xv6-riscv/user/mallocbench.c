@@ -0,0 +1,82 @@
+// malloc/free benchmark.
+// Allocates many small blocks of mixed sizes and frees them in
+// a scrambled order, then does the same with page-sized blocks,
+// as pa4test does. Reports the time for each and how much of the
+// heap is left behind afterwards.
+//
+//   mallocbench [nblocks] [rounds]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define MAXBLOCKS 20000
+
+char *blocks[MAXBLOCKS];
+uint seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+// Allocate n small or page-sized blocks, then free them in a
+// scrambled order. Returns the ticks taken.
+int
+run(int n, int rounds, int small)
+{
+  int r, i, j, t0;
+  char *t;
+
+  t0 = uptime();
+  for(r = 0; r < rounds; r++){
+    for(i = 0; i < n; i++){
+      blocks[i] = malloc(small ? 8 + rnd() % 505 : PGSIZE);
+      if(blocks[i] == 0){
+        fprintf(2, "mallocbench: malloc failed at %d\n", i);
+        exit(1);
+      }
+      blocks[i][0] = i;
+    }
+    for(i = n - 1; i > 0; i--){
+      j = rnd() % (i + 1);
+      t = blocks[i];
+      blocks[i] = blocks[j];
+      blocks[j] = t;
+    }
+    for(i = 0; i < n; i++)
+      free(blocks[i]);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 10000, rounds = 4, t;
+  char *brk0;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(n <= 0 || n > MAXBLOCKS || rounds <= 0){
+    fprintf(2, "usage: mallocbench [nblocks <= %d] [rounds]\n", MAXBLOCKS);
+    exit(1);
+  }
+
+  brk0 = sbrk(0);
+  t = run(n, rounds, 1);
+  printf("small: %d x %d blocks in %d ms, heap %d KB\n", rounds, n,
+         t * 1000 / HZ, (int)(sbrk(0) - brk0) / 1024);
+
+  brk0 = sbrk(0);
+  t = run(n / 4, rounds, 0);
+  printf("pages: %d x %d pages in %d ms, heap %d KB left\n", rounds, n / 4,
+         t * 1000 / HZ, (int)(sbrk(0) - brk0) / 1024);
+  exit(0);
+}
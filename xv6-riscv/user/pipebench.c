@@ -0,0 +1,85 @@
+// Pipe throughput benchmark.
+// A child streams a fixed amount of data through a pipe,
+// the parent reads it back, checks it, and reports the rate.
+//
+//   pipebench [kbytes] [bufsize]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MAXBUF 8192
+
+char buf[MAXBUF];
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], pid, n, i, bufsize;
+  uint total, nbytes, pos;
+  int t0, t1;
+
+  nbytes = 4096 * 1024;
+  bufsize = 4096;
+  if(argc > 1)
+    nbytes = atoi(argv[1]) * 1024;
+  if(argc > 2)
+    bufsize = atoi(argv[2]);
+  if(bufsize <= 0 || bufsize > MAXBUF){
+    fprintf(2, "pipebench: bufsize must be 1..%d\n", MAXBUF);
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    fprintf(2, "pipebench: pipe failed\n");
+    exit(1);
+  }
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pipebench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(pos = 0; pos < nbytes; pos += n){
+      n = bufsize;
+      if(n > nbytes - pos)
+        n = nbytes - pos;
+      for(i = 0; i < n; i++)
+        buf[i] = (pos + i) % 251;
+      if(write(fds[1], buf, n) != n){
+        fprintf(2, "pipebench: write failed\n");
+        exit(1);
+      }
+    }
+    close(fds[1]);
+    exit(0);
+  }
+
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, bufsize)) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (total + i) % 251){
+        fprintf(2, "pipebench: bad data at byte %d\n", total + i);
+        exit(1);
+      }
+    }
+    total += n;
+  }
+  close(fds[0]);
+  wait(0);
+  t1 = uptime();
+
+  if(total != nbytes){
+    fprintf(2, "pipebench: short transfer %d of %d bytes\n", total, nbytes);
+    exit(1);
+  }
+  printf("pipebench: %d KB in %d ticks", total / 1024, t1 - t0);
+  if(t1 > t0)
+    printf(", %d KB/tick", total / 1024 / (t1 - t0));
+  printf("\n");
+  exit(0);
+}
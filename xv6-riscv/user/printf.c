@@ -1,3 +1,4 @@
+#include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
@@ -6,10 +7,120 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Output is buffered per file descriptor, and written when a
+// buffer fills, at the end of each call for fd 2, at the end of
+// a call that printed a newline for the console, and otherwise
+// (files and pipes) by fflush(). ulib.c flushes before exit,
+// fork and exec, and flushes an fd before closing it.
+// One mutex covers the streams, so threads may print at once;
+// each call's output stays together.
+
+#define BUFSIZE 512
+
+enum { UNBUF = 1, LINEBUF, FULLBUF };
+
+struct stream {
+  int mode;
+  int n;
+  int nl;        // buffer holds a newline
+  char buf[BUFSIZE];
+};
+
+static struct stream *streams[NOFILE];
+static struct mutex lock;
+
+extern void (*stdioflush)(int);
+
+static void
+flush(struct stream *s, int fd)
+{
+  int i, n;
+
+  for(i = 0; i < s->n; i += n)
+    if((n = write(fd, s->buf + i, s->n - i)) <= 0)
+      break;
+  s->n = 0;
+  s->nl = 0;
+}
+
+// Flush fd, or every stream if fd is -1.
+// The caller holds lock.
+static void
+flushfd(int fd)
+{
+  if(fd < 0){
+    for(fd = 0; fd < NOFILE; fd++)
+      if(streams[fd])
+        flush(streams[fd], fd);
+  } else if(fd < NOFILE && streams[fd])
+    flush(streams[fd], fd);
+}
+
+void
+fflush(int fd)
+{
+  mutex_lock(&lock);
+  flushfd(fd);
+  mutex_unlock(&lock);
+}
+
+// Called by ulib.c: fd is about to be closed, or with -1,
+// the process is about to exit, fork or exec.
+static void
+closeflush(int fd)
+{
+  mutex_lock(&lock);
+  flushfd(fd);
+  // fd may be reopened as something else.
+  if(fd >= 0 && fd < NOFILE && streams[fd])
+    streams[fd]->mode = 0;
+  mutex_unlock(&lock);
+}
+
+// The stream for fd, or 0 to write it unbuffered.
+// The caller holds lock.
+static struct stream*
+getstream(int fd)
+{
+  struct stream *s;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  if((s = streams[fd]) == 0){
+    if((s = malloc(sizeof(*s))) == 0)
+      return 0;
+    s->mode = 0;
+    s->n = 0;
+    s->nl = 0;
+    streams[fd] = s;
+    stdioflush = closeflush;
+  }
+  if(s->mode == 0){
+    if(fd == 2)
+      s->mode = UNBUF;
+    else if(fstat(fd, &st) == 0 && st.type == T_DEVICE)
+      s->mode = LINEBUF;
+    else
+      s->mode = FULLBUF;
+  }
+  return s;
+}
+
 static void
 putc(int fd, char c)
 {
-  write(fd, &c, 1);
+  struct stream *s;
+
+  if((s = getstream(fd)) == 0){
+    write(fd, &c, 1);
+    return;
+  }
+  if(s->n == BUFSIZE)
+    flush(s, fd);
+  s->buf[s->n++] = c;
+  if(c == '\n')
+    s->nl = 1;
 }
 
 static void
@@ -51,9 +162,11 @@ printptr(int fd, uint64 x) {
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
+  struct stream *st;
   char *s;
   int c0, c1, c2, i, state;
 
+  mutex_lock(&lock);
   state = 0;
   for(i = 0; fmt[i]; i++){
     c0 = fmt[i] & 0xff;
@@ -136,6 +249,11 @@ vprintf(int fd, const char *fmt, va_list ap)
       state = 0;
     }
   }
+
+  if((st = getstream(fd)) != 0 &&
+     (st->mode == UNBUF || (st->mode == LINEBUF && st->nl)))
+    flush(st, fd);
+  mutex_unlock(&lock);
 }
 
 void
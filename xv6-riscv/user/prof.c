@@ -0,0 +1,122 @@
+// Profile a command with the kernel's sampling profiler.
+// Prints the most often sampled program counters as lines of
+//   count	k|u	pc
+// (kernel or user space), followed by a total. On the host,
+// profsym.pl turns these into a profile by function.
+//
+//   prof [-n count] command [args...]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+#define NHASH  4096  // distinct pcs counted
+#define NBUF   64    // samples read at a time
+#define STACK  4096
+
+struct entry {
+  uint64 pc;
+  int user;
+  int count;
+} tab[NHASH];
+
+struct profsample sbuf[NBUF];
+int nsamples, nlost;
+volatile int done;
+
+void
+count(struct profsample *s)
+{
+  uint h = (s->pc >> 1) % NHASH;
+  int i;
+
+  nsamples++;
+  for(i = 0; i < NHASH; i++, h = (h + 1) % NHASH){
+    if(tab[h].count == 0){
+      tab[h].pc = s->pc;
+      tab[h].user = s->user;
+    }
+    if(tab[h].pc == s->pc && tab[h].user == s->user){
+      tab[h].count++;
+      return;
+    }
+  }
+  nlost++;
+}
+
+void
+drain(void)
+{
+  int i, n;
+
+  while((n = profread(sbuf, NBUF)) > 0)
+    for(i = 0; i < n; i++)
+      count(&sbuf[i]);
+}
+
+// Empty the kernel's sample rings while the command runs.
+void
+drainer(void *arg)
+{
+  while(!done){
+    drain();
+    sleep(1);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int show = 20, pid, tid, dropped, i, j, best;
+  char *stack;
+
+  argv++;
+  argc--;
+  if(argc >= 2 && strcmp(argv[0], "-n") == 0){
+    show = atoi(argv[1]);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 1){
+    fprintf(2, "usage: prof [-n count] command [args...]\n");
+    exit(1);
+  }
+
+  profile(1);
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[0], argv);
+    fprintf(2, "prof: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+  stack = malloc(STACK);
+  if((tid = clone(drainer, 0, stack + STACK)) < 0){
+    fprintf(2, "prof: clone failed\n");
+    exit(1);
+  }
+  wait(0);
+  dropped = profile(0);
+  done = 1;
+  join(tid, 0);
+  drain();
+
+  // the most frequent first, by selection.
+  for(i = 0; i < show; i++){
+    best = -1;
+    for(j = 0; j < NHASH; j++)
+      if(tab[j].count > 0 && (best < 0 || tab[j].count > tab[best].count))
+        best = j;
+    if(best < 0)
+      break;
+    printf("%d\t%c\t0x%lx\n", tab[best].count, tab[best].user ? 'u' : 'k', tab[best].pc);
+    tab[best].count = -tab[best].count;
+  }
+  printf("%d samples, %d dropped, %d uncounted\n", nsamples, dropped, nlost);
+  exit(0);
+}
@@ -0,0 +1,89 @@
+// Parallel sum benchmark.
+// Sums an array with 1, 2, ... up to nthreads threads made
+// by clone(), each adding up a slice of the shared array,
+// and reports the time each run takes.
+//
+//   psum [nthreads] [nints]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MAXTHREADS 8
+#define STACKSIZE 4096
+
+int *a;
+int n;
+int nthreads;
+uint64 partial[MAXTHREADS];
+
+void
+worker(void *arg)
+{
+  int id = (int)(uint64)arg;
+  int lo = (uint64)n * id / nthreads;
+  int hi = (uint64)n * (id + 1) / nthreads;
+  uint64 sum = 0;
+
+  for(int i = lo; i < hi; i++)
+    sum += a[i];
+  partial[id] = sum;
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxthreads = 4, tids[MAXTHREADS];
+  char *stacks;
+  uint64 sum, want, t0, t1;
+  int i, t;
+
+  n = 1 << 20;
+  if(argc > 1)
+    maxthreads = atoi(argv[1]);
+  if(argc > 2)
+    n = atoi(argv[2]);
+  if(maxthreads < 1 || maxthreads > MAXTHREADS || n < 1){
+    fprintf(2, "psum: nthreads must be 1..%d\n", MAXTHREADS);
+    exit(1);
+  }
+
+  a = malloc(n * sizeof(int));
+  stacks = malloc(MAXTHREADS * STACKSIZE);
+  if(a == 0 || stacks == 0){
+    fprintf(2, "psum: out of memory\n");
+    exit(1);
+  }
+  want = 0;
+  for(i = 0; i < n; i++){
+    a[i] = i % 1000;
+    want += a[i];
+  }
+
+  for(nthreads = 1; nthreads <= maxthreads; nthreads++){
+    t0 = uptime_ns();
+    for(t = 0; t < nthreads; t++){
+      tids[t] = clone(worker, (void*)(uint64)t, stacks + (t+1)*STACKSIZE);
+      if(tids[t] < 0){
+        fprintf(2, "psum: clone failed\n");
+        exit(1);
+      }
+    }
+    sum = 0;
+    for(t = 0; t < nthreads; t++){
+      if(join(tids[t], 0) != tids[t]){
+        fprintf(2, "psum: join failed\n");
+        exit(1);
+      }
+      sum += partial[t];
+    }
+    t1 = uptime_ns();
+    if(sum != want){
+      fprintf(2, "psum: got %ld, want %ld\n", sum, want);
+      exit(1);
+    }
+    printf("%d threads: %ld us\n", nthreads, (t1 - t0) / 1000);
+  }
+  exit(0);
+}
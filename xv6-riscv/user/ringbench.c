@@ -0,0 +1,152 @@
+// Compare system calls made one at a time with the same calls
+// batched through the system call ring: n fstat()s, then n
+// 16-byte writes to a pipe, each followed by a read of them.
+// Batches go in with one ringenter() each, and then with a
+// thread polling the ring in the kernel, with no system calls.
+//
+//   ringbench [n] [batch]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/ring.h"
+#include "user/user.h"
+
+#define STACK 4096
+
+enum { SYSCALL, ENTER, POLL };
+char *modename[] = { "syscall", "enter", "poll" };
+
+struct ring *r;
+int mode, batch;
+int dirfd, fds[2];
+char buf[16];
+struct stat st;
+
+// Queue one submission. There is always room: no more than a
+// batch is outstanding.
+void
+submit(int op, int fd, void *addr, int n)
+{
+  struct ringsqe *e;
+  uint t = r->sqtail;
+
+  e = &r->sq[t % RINGSIZE];
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->data = t;
+  __atomic_store_n(&r->sqtail, t + 1, __ATOMIC_RELEASE);
+}
+
+// Have the kernel run what was submitted, and wait for n
+// completions. Returns how many of them failed.
+int
+complete(int n)
+{
+  uint h = r->cqhead;
+  int bad = 0;
+
+  if(mode == ENTER)
+    ringenter(0);
+  else {
+    // sqtail before needwake, as the poller does the reverse.
+    __sync_synchronize();
+    if(__atomic_load_n(&r->needwake, __ATOMIC_SEQ_CST))
+      ringenter(RING_WAKE);
+  }
+  for(; n > 0; n--){
+    while(h == __atomic_load_n(&r->cqtail, __ATOMIC_ACQUIRE))
+      ;
+    if(r->cq[h % RINGSIZE].res < 0)
+      bad++;
+    __atomic_store_n(&r->cqhead, ++h, __ATOMIC_RELEASE);
+  }
+  return bad;
+}
+
+void
+poller(void *arg)
+{
+  ringenter(RING_POLL);
+  exit(0);
+}
+
+// Run n operations of the given kind (0: fstat, 1: pipe write
+// and read) and return the ns taken.
+uint64
+run(int kind, int n)
+{
+  uint64 t0;
+  int i, j, m, bad = 0;
+
+  t0 = uptime_ns();
+  for(i = 0; i < n; i += m){
+    m = n - i < batch ? n - i : batch;
+    for(j = 0; j < m; j++){
+      if(mode == SYSCALL){
+        if(kind == 0)
+          bad += fstat(dirfd, &st) < 0;
+        else
+          bad += write(fds[1], buf, 16) != 16 || read(fds[0], buf, 16) != 16;
+      } else if(kind == 0){
+        submit(RING_FSTAT, dirfd, &st, 0);
+      } else {
+        submit(RING_WRITE, fds[1], buf, 16);
+        submit(RING_READ, fds[0], buf, 16);
+      }
+    }
+    if(mode != SYSCALL)
+      bad += complete(kind == 0 ? m : 2 * m);
+  }
+  if(bad){
+    fprintf(2, "ringbench: %d operations failed\n", bad);
+    exit(1);
+  }
+  return uptime_ns() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n = 10000, tid = 0;
+  uint64 t;
+  char *stack;
+
+  batch = 16;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(argc > 2)
+    batch = atoi(argv[2]);
+  if(n <= 0 || batch <= 0 || 2 * batch > RINGSIZE){
+    fprintf(2, "usage: ringbench [n] [batch <= %d]\n", RINGSIZE / 2);
+    exit(1);
+  }
+  if((dirfd = open(".", 0)) < 0 || pipe(fds) < 0){
+    fprintf(2, "ringbench: open or pipe failed\n");
+    exit(1);
+  }
+  if((r = ringsetup()) == (struct ring*)-1){
+    fprintf(2, "ringbench: ringsetup failed\n");
+    exit(1);
+  }
+
+  for(mode = SYSCALL; mode <= POLL; mode++){
+    if(mode == POLL){
+      stack = malloc(STACK);
+      if((tid = clone(poller, 0, stack + STACK)) < 0){
+        fprintf(2, "ringbench: clone failed\n");
+        exit(1);
+      }
+    }
+    t = run(0, n);
+    printf("%s: fstat %ld ns", modename[mode], t / n);
+    t = run(1, n);
+    printf(", pipe write+read %ld ns\n", t / n);
+  }
+
+  __atomic_store_n(&r->stop, 1, __ATOMIC_SEQ_CST);
+  ringenter(RING_WAKE);
+  join(tid, 0);
+  exit(0);
+}
@@ -0,0 +1,192 @@
+// Trace kernel events while a command runs, then print them
+// in the order they happened, one per line:
+//   time(us)	cpu	pid	event	arguments
+//
+//   trace [-e event,event,...] command [args...]
+//
+// Events are named as in kernel/trace.h, without TR_ and in
+// lower case; the default is all of them.
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/trace.h"
+#include "user/user.h"
+
+#define MAXEV  16384  // events kept
+#define NREAD  64     // events read at a time
+#define STACK  4096
+
+char *evname[NTREVENT] = {
+[TR_KALLOC]   "kalloc",
+[TR_SWAPOUT]  "swapout",
+[TR_SWAPIN]   "swapin",
+[TR_BREAD]    "bread",
+[TR_BWRITE]   "bwrite",
+[TR_DISK]     "disk",
+[TR_DISKDONE] "diskdone",
+[TR_SLEEP]    "sleep",
+[TR_WAKEUP]   "wakeup",
+[TR_SWITCH]   "switch",
+};
+
+struct traceevent *ev, *tmp;
+struct traceevent rbuf[NREAD];
+int nev, nlost;
+volatile int done;
+
+void
+drain(void)
+{
+  int i, n;
+
+  while((n = traceread(rbuf, NREAD)) > 0){
+    for(i = 0; i < n; i++){
+      if(nev < MAXEV)
+        ev[nev++] = rbuf[i];
+      else
+        nlost++;
+    }
+  }
+}
+
+// Empty the kernel's rings while the command runs.
+void
+drainer(void *arg)
+{
+  while(!done){
+    drain();
+    sleep(1);
+  }
+  exit(0);
+}
+
+// Parse a list of event names into a mask, or return 0.
+uint
+parsemask(char *s)
+{
+  char name[16];
+  uint mask = 0;
+  int i, n;
+
+  while(*s){
+    for(n = 0; s[n] && s[n] != ',' && n < sizeof(name)-1; n++)
+      name[n] = s[n];
+    name[n] = 0;
+    s += n;
+    if(*s == ',')
+      s++;
+    for(i = 0; i < NTREVENT; i++)
+      if(strcmp(name, evname[i]) == 0)
+        break;
+    if(i == NTREVENT){
+      fprintf(2, "trace: unknown event %s\n", name);
+      return 0;
+    }
+    mask |= 1 << i;
+  }
+  return mask;
+}
+
+// Sort ev[lo..hi) by time, keeping each CPU's events,
+// which traceread() returns in order, in order.
+void
+sort(int lo, int hi)
+{
+  int mid, i, j, k;
+
+  if(hi - lo < 2)
+    return;
+  mid = (lo + hi) / 2;
+  sort(lo, mid);
+  sort(mid, hi);
+  for(i = lo, j = mid, k = lo; k < hi; k++){
+    if(j == hi || (i < mid && ev[i].time <= ev[j].time))
+      tmp[k] = ev[i++];
+    else
+      tmp[k] = ev[j++];
+  }
+  memmove(&ev[lo], &tmp[lo], (hi - lo) * sizeof(ev[0]));
+}
+
+void
+print(struct traceevent *e, uint64 t0)
+{
+  printf("%ld\t%d\t%d\t%s", (e->time - t0) * 1000000 / TIMEBASE,
+         e->cpu, e->pid, e->event < NTREVENT ? evname[e->event] : "?");
+  switch(e->event){
+  case TR_KALLOC:
+  case TR_SWAPOUT:
+  case TR_SWAPIN:
+  case TR_WAKEUP:
+    printf("\t0x%lx %ld\n", e->arg[0], e->arg[1]);
+    break;
+  case TR_SLEEP:
+    printf("\t0x%lx\n", e->arg[0]);
+    break;
+  default:
+    printf("\t%ld %ld\n", e->arg[0], e->arg[1]);
+    break;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint mask = TR_ALL;
+  int pid, tid, dropped, i;
+  char *stack;
+
+  argv++;
+  argc--;
+  if(argc >= 2 && strcmp(argv[0], "-e") == 0){
+    if((mask = parsemask(argv[1])) == 0)
+      exit(1);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 1){
+    fprintf(2, "usage: trace [-e event,...] command [args...]\n");
+    exit(1);
+  }
+
+  ev = malloc(MAXEV * sizeof(ev[0]));
+  tmp = malloc(MAXEV * sizeof(ev[0]));
+  stack = malloc(STACK);
+  if(ev == 0 || tmp == 0 || stack == 0){
+    fprintf(2, "trace: out of memory\n");
+    exit(1);
+  }
+
+  // throw away old events.
+  tracectl(0);
+  while(traceread(rbuf, NREAD) > 0)
+    ;
+
+  tracectl(mask);
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "trace: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[0], argv);
+    fprintf(2, "trace: exec %s failed\n", argv[0]);
+    exit(1);
+  }
+  if((tid = clone(drainer, 0, stack + STACK)) < 0){
+    fprintf(2, "trace: clone failed\n");
+    exit(1);
+  }
+  wait(0);
+  dropped = tracectl(0);
+  done = 1;
+  join(tid, 0);
+  drain();
+
+  sort(0, nev);
+  for(i = 0; i < nev; i++)
+    print(&ev[i], ev[0].time);
+  printf("%d events, %d dropped, %d not kept\n", nev, dropped, nlost);
+  exit(0);
+}
@@ -1,8 +1,24 @@
+#include "kernel/param.h"
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/vdata.h"
 #include "user/user.h"
 
+// The system calls wrapped below, from usys.S.
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _close(int);
+int _exec(const char*, char**);
+
+// Set by printf.c once it buffers output, so that buffers are
+// flushed before they would be lost or copied, without linking
+// printf.c into every program. The argument is the fd being
+// closed, or -1 for all.
+void (*stdioflush)(int);
+
 //
 // wrapper so that it's OK if main() does not call exit().
 //
@@ -14,6 +30,56 @@ start()
   exit(0);
 }
 
+int
+fork(void)
+{
+  if(stdioflush)
+    stdioflush(-1);
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  if(stdioflush)
+    stdioflush(-1);
+  _exit(status);
+}
+
+int
+close(int fd)
+{
+  if(stdioflush)
+    stdioflush(fd);
+  return _close(fd);
+}
+
+int
+exec(const char *path, char **argv)
+{
+  if(stdioflush)
+    stdioflush(-1);
+  return _exec(path, argv);
+}
+
+// The clock, from the kernel's data page and the time CSR,
+// without a system call.
+int
+uptime(void)
+{
+  struct vdata *vd = (struct vdata*)VDATA;
+
+  return (r_time() - vd->boottime) / vd->tickinterval;
+}
+
+uint64
+uptime_ns(void)
+{
+  struct vdata *vd = (struct vdata*)VDATA;
+
+  return (r_time() - vd->boottime) * (1000000000L / vd->timebase);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -69,6 +135,9 @@ gets(char *buf, int max)
   int i, cc;
   char c;
 
+  // show a prompt before waiting for the answer.
+  if(stdioflush)
+    stdioflush(-1);
   for(i=0; i+1 < max; ){
     cc = read(0, &c, 1);
     if(cc < 1)
@@ -145,3 +214,60 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// A mutex that sleeps in the kernel only when it is
+// contended, after Drepper's "Futexes Are Tricky".
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  // say there is a waiter, and sleep until the lock is free.
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __sync_lock_test_and_set(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->state, 1) != 1){
+    // someone may be waiting.
+    __sync_lock_release(&m->state);
+    futex_wake(&m->state, 1);
+  }
+}
+
+// Release m, wait for cond_signal() or cond_broadcast()
+// on c, and take m again. May also return early, so
+// callers should check their condition in a loop.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  // others may be waiting for m too; lock as a waiter.
+  while(__sync_lock_test_and_set(&m->state, 2) != 0)
+    futex_wait(&m->state, 2);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);
+}
@@ -2,89 +2,377 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// Small requests are rounded up, with a header, to a power of
+// two and served from a free list per size, filled by carving
+// up whole pages. The header names the block's size class, so
+// malloc and free of small blocks take constant time. Those
+// pages are not given back.
+//
+// Larger requests get whole pages, page-aligned and with no
+// header, from a run of pages (a span). A free span keeps its
+// length and free-list links in its own first page. A hash
+// table, keyed by page address, records the length of each
+// span in use, and the first and last page of each free span,
+// so free can find a block's length and merge it with free
+// neighbors in constant time. A long enough free span at the
+// top of the heap is handed back to the kernel with a negative
+// sbrk. The table is the only other bookkeeping in the heap,
+// and it moves when it grows or shrinks.
 
 typedef long Align;
 
 union header {
   struct {
-    union header *ptr;
-    uint size;
+    union header *next;  // free list of the size class
+    uint cls;
   } s;
   Align x;
 };
 
 typedef union header Header;
 
-static Header base;
-static Header *freep;
+#define MINCLASS 5   // smallest block is 1<<MINCLASS bytes
+#define NCLASS   7   // 32 .. 2048 bytes, with header
+#define MAXSMALL ((1 << (MINCLASS+NCLASS-1)) - sizeof(Header))
 
-void
-free(void *ap)
+static Header *classes[NCLASS];
+
+#define NFREE    16   // free span lists: 1..NFREE-2 pages, and longer
+#define TRIM     16   // shortest free top span given back
+#define MAXPAGES (0x7fffffff / PGSIZE)
+#define MINTAB   256  // table entries, one page
+#define SLACK    8    // table entries one call may use
+
+enum { EMPTY, USED, FREE, TAIL, GONE };
+
+struct pgent {
+  char *addr;
+  uint npages;  // length of the span
+  uint tag;     // USED or FREE: first page; TAIL: last page
+};
+
+struct span {
+  uint npages;
+  struct span *prev, *next;  // free list
+};
+
+static struct span *freelist[NFREE];
+static struct pgent *tab;
+static uint ntab, nent, ngone;
+
+static int
+listof(uint npages)
+{
+  return npages < NFREE-1 ? npages : NFREE-1;
+}
+
+static uint
+hashof(char *addr)
+{
+  return ((uint64)addr / PGSIZE) & (ntab - 1);
+}
+
+static struct pgent*
+tfind(char *addr)
+{
+  uint i;
+
+  if(ntab == 0)
+    return 0;
+  for(i = hashof(addr); tab[i].tag != EMPTY; i = (i + 1) & (ntab - 1))
+    if(tab[i].addr == addr && tab[i].tag != GONE)
+      return &tab[i];
+  return 0;
+}
+
+// Enter addr, which must not be in the table. Does nothing
+// while the first table is being allocated.
+static void
+tput(char *addr, uint npages, int tag)
 {
-  Header *bp, *p;
+  uint i;
 
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  if(ntab == 0)
+    return;
+  for(i = hashof(addr); tab[i].tag != EMPTY && tab[i].tag != GONE; i = (i + 1) & (ntab - 1))
+    ;
+  if(tab[i].tag == GONE)
+    ngone--;
+  tab[i].addr = addr;
+  tab[i].npages = npages;
+  tab[i].tag = tag;
+  nent++;
 }
 
-static Header*
-morecore(uint nu)
+static void
+tdel(char *addr)
 {
+  struct pgent *e;
+
+  if((e = tfind(addr)) != 0){
+    e->tag = GONE;
+    nent--;
+    ngone++;
+  }
+}
+
+// Make the n pages at addr a free span.
+static void
+setfree(char *addr, uint n)
+{
+  struct span *s = (struct span*)addr;
+  struct span **l = &freelist[listof(n)];
+
+  s->npages = n;
+  s->prev = 0;
+  s->next = *l;
+  if(*l)
+    (*l)->prev = s;
+  *l = s;
+  tput(addr, n, FREE);
+  if(n > 1)
+    tput(addr + (n - 1) * PGSIZE, n, TAIL);
+}
+
+static void
+unsetfree(struct span *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    freelist[listof(s->npages)] = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  tdel((char*)s);
+  if(s->npages > 1)
+    tdel((char*)s + (s->npages - 1) * PGSIZE);
+}
+
+// The free span starting at addr, if any.
+static struct span*
+freeat(char *addr)
+{
+  struct pgent *e = tfind(addr);
+
+  if(e && e->tag == FREE)
+    return (struct span*)addr;
+  return 0;
+}
+
+// The free span ending at addr, if any.
+static struct span*
+freebefore(char *addr)
+{
+  struct pgent *e = tfind(addr - PGSIZE);
+
+  if(e && e->tag == TAIL)
+    return (struct span*)(addr - e->npages * PGSIZE);
+  if(e && e->tag == FREE)
+    return (struct span*)e->addr;
+  return 0;
+}
+
+// Round the break up to a page boundary, since the program
+// or its loader may have left it elsewhere. Returns the break,
+// or 0 if out of memory.
+static char*
+brkalign(void)
+{
+  char *p = sbrk(0);
+  uint n = PGROUNDUP((uint64)p) - (uint64)p;
+
+  if(n && sbrk(n) == (char*)-1)
+    return 0;
+  return p + n;
+}
+
+// A page for small blocks: the front of the shortest free
+// span if there is one, else a new page.
+static char*
+getpage(void)
+{
+  struct span *s;
   char *p;
-  Header *hp;
+  int i;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  for(i = 1; i < NFREE; i++){
+    if((s = freelist[i]) != 0){
+      unsetfree(s);
+      if(s->npages > 1)
+        setfree((char*)s + PGSIZE, s->npages - 1);
+      return (char*)s;
+    }
+  }
+  if(brkalign() == 0 || (p = sbrk(PGSIZE)) == (char*)-1)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  return p;
 }
 
-void*
-malloc(uint nbytes)
+// Allocate n pages: a free span that fits, split if longer,
+// else new pages from the kernel.
+static char*
+allocspan(uint n)
+{
+  struct span *s;
+  char *p;
+  uint m;
+  int i;
+
+  for(i = listof(n); i < NFREE; i++)
+    for(s = freelist[i]; s; s = s->next)
+      if(s->npages >= n)
+        goto found;
+
+  // nothing fits: extend a free span at the top of the heap
+  // if there is one.
+  if((p = brkalign()) == 0)
+    return 0;
+  if((s = freebefore(p)) != 0){
+    if(sbrk((n - s->npages) * PGSIZE) == (char*)-1)
+      return 0;
+    unsetfree(s);
+    p = (char*)s;
+  } else if((p = sbrk(n * PGSIZE)) == (char*)-1)
+    return 0;
+  tput(p, n, USED);
+  return p;
+
+found:
+  m = s->npages;
+  unsetfree(s);
+  if(m > n)
+    setfree((char*)s + n * PGSIZE, m - n);
+  tput((char*)s, n, USED);
+  return (char*)s;
+}
+
+static void
+freespan(char *p, uint n)
+{
+  struct span *s;
+
+  tdel(p);
+  if((s = freeat(p + n * PGSIZE)) != 0){
+    n += s->npages;
+    unsetfree(s);
+  }
+  if((s = freebefore(p)) != 0){
+    n += s->npages;
+    p = (char*)s;
+    unsetfree(s);
+  }
+  if(n >= TRIM && p + n * PGSIZE == sbrk(0) &&
+     sbrk(-(int)(n * PGSIZE)) != (char*)-1)
+    return;
+  setfree(p, n);
+}
+
+// Move the table to a new one of n entries.
+static int
+retable(uint n)
+{
+  struct pgent *old = tab;
+  uint oldn = ntab, i;
+  char *p;
+
+  if((p = allocspan(n * sizeof(struct pgent) / PGSIZE)) == 0)
+    return -1;
+  tab = (struct pgent*)p;
+  ntab = n;
+  nent = ngone = 0;
+  memset(tab, 0, n * sizeof(struct pgent));
+  for(i = 0; i < oldn; i++)
+    if(old[i].tag != EMPTY && old[i].tag != GONE)
+      tput(old[i].addr, old[i].npages, old[i].tag);
+  if(old)
+    freespan((char*)old, oldn * sizeof(struct pgent) / PGSIZE);
+  return 0;
+}
+
+// Keep the table at most half full, counting deleted entries,
+// with room for the next call's updates, and shrink it when it
+// is mostly empty so that it does not hold up trimming. If
+// growing fails the old table still has room for one call.
+static int
+tcheck(void)
 {
-  Header *p, *prevp;
-  uint nunits;
+  uint n;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  if(ntab && (nent + ngone + SLACK) * 2 <= ntab &&
+     (nent * 16 >= ntab || ntab == MINTAB))
+    return 0;
+  for(n = MINTAB; n < (nent + SLACK) * 4; n *= 2)
+    ;
+  return retable(n);
+}
+
+// Carve a page into blocks of class c.
+static int
+morecore(uint c)
+{
+  Header *h;
+  char *p;
+  int i, size;
+
+  if((tcheck() < 0 && ntab == 0) || (p = getpage()) == 0)
+    return -1;
+  size = 1 << (c + MINCLASS);
+  for(i = 0; i < PGSIZE; i += size){
+    h = (Header*)(p + i);
+    h->s.cls = c;
+    h->s.next = classes[c];
+    classes[c] = h;
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
+  return 0;
+}
+
+void
+free(void *ap)
+{
+  Header *h;
+  struct pgent *e;
+
+  if(ap == 0)
+    return;
+
+  // small blocks sit after their header, so are never
+  // page-aligned.
+  if((uint64)ap % PGSIZE == 0){
+    if((e = tfind(ap)) != 0 && e->tag == USED){
+      freespan(ap, e->npages);
+      tcheck();
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+    return;
   }
+  h = (Header*)ap - 1;
+  h->s.next = classes[h->s.cls];
+  classes[h->s.cls] = h;
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *h;
+  uint c, n;
+
+  if(nbytes <= MAXSMALL){
+    for(c = 0; (1 << (c + MINCLASS)) < nbytes + sizeof(Header); c++)
+      ;
+    if(classes[c] == 0 && morecore(c) < 0)
+      return 0;
+    h = classes[c];
+    classes[c] = h->s.next;
+    return (void*)(h + 1);
+  }
+
+  n = nbytes / PGSIZE + (nbytes % PGSIZE != 0);
+  if(n > MAXPAGES)
+    return 0;
+  if(tcheck() < 0 && ntab == 0)
+    return 0;
+  return allocspan(n);
 }
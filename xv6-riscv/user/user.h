@@ -1,4 +1,19 @@
 struct stat;
+struct iovec;
+struct lockstat;
+struct profsample;
+struct traceevent;
+struct ring;
+
+// Locks for threads made by clone(), from ulib.c.
+// Zero-filled ones are ready to use.
+struct mutex {
+  int state;  // 0: free, 1: held, 2: held and maybe waited for
+};
+
+struct cond {
+  int seq;    // bumped by every signal
+};
 
 // system calls
 int fork(void);
@@ -21,11 +36,29 @@ int dup(int);
 int getpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
 // pa4: swap functions
 void swapread(const char*, int);
 void swapwrite(const char*, int);
 void swapstat(int*, int*);
+int sendfile(int, int, int, int);
+int splice(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int setpriority(int, int);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int lockstat(struct lockstat*, int);
+int profile(int);
+int profread(struct profsample*, int);
+int tracectl(uint);
+int traceread(struct traceevent*, int);
+struct ring* ringsetup(void);
+int ringenter(int);
+int sync(void);
 
 
 
@@ -37,12 +70,20 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
 void printf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
+void fflush(int);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+int uptime(void);
+uint64 uptime_ns(void);
 
 // umalloc.c
 void* malloc(uint);
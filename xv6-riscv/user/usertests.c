@@ -4,6 +4,12 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uio.h"
+#include "kernel/lockstat.h"
+#include "kernel/prof.h"
+#include "kernel/trace.h"
+#include "kernel/ring.h"
+#include "kernel/vdata.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -789,6 +795,784 @@ pipe1(char *s)
 }
 
 
+// sendfile() and splice() move data between files and pipes
+// without going through user memory.
+void
+sendfiletest(char *s)
+{
+  int fd, fd2, fds[2], i, n;
+  enum { SZ=3000, OFF=1000 };
+
+  unlink("sendfile");
+  fd = open("sendfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create sendfile failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write sendfile failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  fd = open("sendfile", O_RDONLY);
+  if(sendfile(fds[1], fd, OFF, SZ) != SZ - OFF){
+    printf("%s: sendfile short\n", s);
+    exit(1);
+  }
+  if((n = read(fds[0], buf, sizeof(buf))) != SZ - OFF){
+    printf("%s: read %d from pipe\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if((buf[i] & 0xff) != ((i + OFF) & 0xff)){
+      printf("%s: sendfile bad data\n", s);
+      exit(1);
+    }
+  }
+  // an explicit offset leaves the file offset alone.
+  if(read(fd, buf, 1) != 1 || buf[0] != 0){
+    printf("%s: sendfile moved the file offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  unlink("sendfile2");
+  fd2 = open("sendfile2", O_CREATE|O_RDWR);
+  if(write(fds[1], "hello", 5) != 5 || splice(fds[0], fd2, 5) != 5){
+    printf("%s: splice failed\n", s);
+    exit(1);
+  }
+  // sendfile() only reads from files.
+  if(sendfile(fd2, fds[0], -1, 5) != -1){
+    printf("%s: sendfile from a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fd2);
+  close(fds[0]);
+  close(fds[1]);
+
+  fd2 = open("sendfile2", O_RDONLY);
+  if(read(fd2, buf, sizeof(buf)) != 5 || memcmp(buf, "hello", 5) != 0){
+    printf("%s: splice bad data\n", s);
+    exit(1);
+  }
+  close(fd2);
+  unlink("sendfile");
+  unlink("sendfile2");
+}
+
+// readv()/writev() gather and scatter across buffers;
+// pread()/pwrite() use an explicit offset.
+void
+preadwrite(char *s)
+{
+  int fd, fds[2];
+  char a[4], b[6];
+  struct iovec iov[3];
+
+  unlink("preadwrite");
+  fd = open("preadwrite", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create preadwrite failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "abc";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "defghij";
+  iov[2].iov_len = 7;
+  if(writev(fd, iov, 3) != 10){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "XY", 2, 4) != 2){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  // pwrite leaves the offset at the end of the writev.
+  if(write(fd, "k", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, sizeof(buf), 2) != 9 || memcmp(buf, "cdXYghijk", 9) != 0){
+    printf("%s: pread wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("preadwrite", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if(readv(fd, iov, 2) != 10 || memcmp(a, "abcd", 4) != 0 ||
+     memcmp(b, "XYghij", 6) != 0){
+    printf("%s: readv wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("preadwrite");
+
+  // pipes have no offset.
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fds[1], "x", 1, 0) != -1 || pread(fds[0], buf, 1, 0) != -1){
+    printf("%s: positional I/O on a pipe succeeded\n", s);
+    exit(1);
+  }
+  // a readv() that fills its first buffer from a pipe returns
+  // rather than wait for more to fill the second.
+  if(write(fds[1], "abcd", 4) != 4){
+    printf("%s: pipe write failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = a;
+  iov[0].iov_len = sizeof(a);
+  iov[1].iov_base = b;
+  iov[1].iov_len = sizeof(b);
+  if(readv(fds[0], iov, 2) != 4 || memcmp(a, "abcd", 4) != 0){
+    printf("%s: pipe readv wrong data\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// one write() larger than a log transaction, at a
+// non-block-aligned offset, must be split correctly.
+void
+hugewrite(char *s)
+{
+  int fd, i, n = 100*1024;
+  char *p;
+
+  p = malloc(n);
+  if(p == 0){
+    printf("%s: malloc failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    p[i] = i % 253;
+  unlink("hugewrite");
+  fd = open("hugewrite", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create hugewrite failed\n", s);
+    exit(1);
+  }
+  if(write(fd, p, 100) != 100 || write(fd, p, n) != n){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  memset(p, 0, n);
+  fd = open("hugewrite", O_RDONLY);
+  if(read(fd, p, 100) != 100 || read(fd, p, n) != n){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != (char)(i % 253)){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink("hugewrite");
+  free(p);
+}
+
+// reads through the page cache must see later writes
+// and truncation.
+void
+pagecache(char *s)
+{
+  int fd, i;
+  char b[8];
+
+  unlink("pagecache");
+  fd = open("pagecache", O_CREATE|O_RDWR);
+  for(i = 0; i < 8; i++){
+    memset(buf, 'a' + i/4, 1024);
+    if(write(fd, buf, 1024) != 1024){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("pagecache", O_RDWR);
+  if(read(fd, b, 4) != 4 || memcmp(b, "aaaa", 4) != 0){
+    printf("%s: read wrong data\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "xyz", 3, 4095) != 3){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, b, 5, 4094) != 5 || memcmp(b, "axyzb", 5) != 0){
+    printf("%s: stale cached page\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("pagecache", O_RDWR|O_TRUNC);
+  if(read(fd, b, 1) != 0){
+    printf("%s: read after truncate\n", s);
+    exit(1);
+  }
+  if(write(fd, "new", 3) != 3 || pread(fd, b, 8, 0) != 3 ||
+     memcmp(b, "new", 3) != 0){
+    printf("%s: wrong data after truncate\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pagecache");
+}
+
+// processes read one file at once, both through their own
+// file descriptors, which share the inode lock, and through
+// one shared descriptor, whose offset they must not both use.
+void
+sharedread(char *s)
+{
+  enum { NW = 4096, CHUNK = 512, NCHILD = 4 };
+  int fd, sfd, i, j, pid, n, xst, total;
+  int *w = (int*)buf;
+
+  unlink("sharedread");
+  fd = open("sharedread", O_CREATE|O_RDWR);
+  for(i = 0; i < NW; i += CHUNK/4){
+    for(j = 0; j < CHUNK/4; j++)
+      w[j] = i + j;
+    if(write(fd, w, CHUNK) != CHUNK){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  sfd = open("sharedread", O_RDONLY);
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      // my own descriptor.
+      fd = open("sharedread", O_RDONLY);
+      for(j = 0; (n = read(fd, w, CHUNK)) > 0; j += n/4)
+        if(n != CHUNK || w[0] != j || w[CHUNK/4-1] != j + CHUNK/4 - 1)
+          exit(-1);
+      if(j != NW)
+        exit(-1);
+      close(fd);
+      // the shared one: count the chunks I got.
+      for(n = 0; read(sfd, w, CHUNK) == CHUNK; n++)
+        if(w[0] % (CHUNK/4) != 0 || w[CHUNK/4-1] != w[0] + CHUNK/4 - 1)
+          exit(-1);
+      exit(n);
+    }
+  }
+  close(sfd);
+  total = 0;
+  for(i = 0; i < NCHILD; i++){
+    wait(&xst);
+    if(xst < 0){
+      printf("%s: child read wrong data\n", s);
+      exit(1);
+    }
+    total += xst;
+  }
+  if(total != NW*4/CHUNK){
+    printf("%s: shared offset gave %d chunks, want %d\n", s, total, NW*4/CHUNK);
+    exit(1);
+  }
+  unlink("sharedread");
+}
+
+// Sum the waits for sleeplocks named name.
+static uint64
+sleepwaits(char *name)
+{
+  static struct lockstat ls[NLOCKCLASS];
+  int i, n;
+
+  n = lockstat(ls, NLOCKCLASS);
+  for(i = 0; i < n; i++)
+    if(strcmp(ls[i].name, name) == 0)
+      return ls[i].nsleepwait;
+  return 0;
+}
+
+// processes reading one file through descriptors of their own
+// share its inode lock, so none of them ever waits for it.
+void
+sharedlock(char *s)
+{
+  enum { SZ = 32*1024, NFD = 8, NCHILD = 2 };
+  int fd, i, j, pid, xst, ready[2], go[2];
+  uint64 w0;
+  char *p, c;
+
+  unlink("sharedlock");
+  fd = open("sharedlock", O_CREATE|O_RDWR);
+  p = malloc(SZ);
+  memset(p, 'x', SZ);
+  if(fd < 0 || write(fd, p, SZ) != SZ){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(pipe(ready) < 0 || pipe(go) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      int fds[NFD];
+      // open first, since open() locks the inode alone.
+      for(j = 0; j < NFD; j++)
+        if((fds[j] = open("sharedlock", O_RDONLY)) < 0)
+          exit(1);
+      write(ready[1], "r", 1);
+      read(go[0], &c, 1);
+      for(j = 0; j < NFD; j++)
+        if(read(fds[j], p, SZ) != SZ)
+          exit(1);
+      write(ready[1], "d", 1);
+      read(go[0], &c, 1);
+      exit(0);
+    }
+  }
+
+  for(i = 0; i < NCHILD; i++)
+    read(ready[0], &c, 1);
+  w0 = sleepwaits("inode");
+  write(go[1], "gg", NCHILD);
+  for(i = 0; i < NCHILD; i++)
+    read(ready[0], &c, 1);
+  if(sleepwaits("inode") != w0){
+    printf("%s: readers waited for the inode lock\n", s);
+    exit(1);
+  }
+  write(go[1], "gg", NCHILD);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xst);
+    if(xst != 0){
+      printf("%s: child read failed\n", s);
+      exit(1);
+    }
+  }
+  free(p);
+  unlink("sharedlock");
+}
+
+// a process's file table grows past its initial 16 entries,
+// and a child inherits all of it.
+void
+manyfds(char *s)
+{
+  enum { N = 100 };
+  int fd, i, pid, xstatus;
+  char c;
+
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  for(i = fd+1; i < N; i++){
+    if(dup(fd) != i){
+      printf("%s: dup did not return %d\n", s, i);
+      exit(1);
+    }
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(read(N-1, &c, 1) != 1)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child could not read fd %d\n", s, N-1);
+    exit(1);
+  }
+  for(i = fd; i < N; i++)
+    close(i);
+}
+
+// threads made by clone() share memory and file descriptors,
+// and join() collects them.
+int cloneslots[4];
+char *clonemem;
+
+void
+cloneworker(void *arg)
+{
+  int id = (int)(uint64)arg;
+
+  cloneslots[id] = id + 1;
+  if(id == 0)
+    clonemem = sbrk(PGSIZE);
+  exit(id);
+}
+
+void
+clonetest(char *s)
+{
+  enum { N = 4, STACK = 4096 };
+  int tids[N], i, xstatus;
+  char *stacks;
+
+  stacks = sbrk(N * STACK);
+  for(i = 0; i < N; i++){
+    tids[i] = clone(cloneworker, (void*)(uint64)i, stacks + (i+1)*STACK);
+    if(tids[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(join(tids[i], &xstatus) != tids[i] || xstatus != i){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+    if(cloneslots[i] != i + 1){
+      printf("%s: thread %d's write not seen\n", s, i);
+      exit(1);
+    }
+  }
+  // memory a thread added is ours too.
+  clonemem[PGSIZE-1] = 1;
+  if(wait(0) != -1){
+    printf("%s: wait returned a thread\n", s);
+    exit(1);
+  }
+  if(join(0, 0) != -1){
+    printf("%s: join with no threads\n", s);
+    exit(1);
+  }
+}
+
+// threads count to a total under a futex mutex, and the
+// last one to finish signals a condition variable.
+struct mutex futexmu;
+struct cond futexcv;
+int futexcount, futexdone;
+
+void
+futexworker(void *arg)
+{
+  int n = (int)(uint64)arg;
+
+  for(int i = 0; i < n; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+  mutex_lock(&futexmu);
+  futexdone++;
+  cond_signal(&futexcv);
+  mutex_unlock(&futexmu);
+  exit(0);
+}
+
+void
+futextest(char *s)
+{
+  enum { N = 4, STACK = 4096, ITERS = 2000 };
+  int tids[N], i, x = 1;
+  char *stacks;
+
+  if(futex_wait(&x, 2) != -1){
+    printf("%s: futex_wait slept on a changed value\n", s);
+    exit(1);
+  }
+  if(futex_wake(&x, 1) != 0 || futex_wait((int*)0xffffffffff00, 0) != -1){
+    printf("%s: futex_wake or bad address\n", s);
+    exit(1);
+  }
+
+  stacks = sbrk(N * STACK);
+  for(i = 0; i < N; i++){
+    tids[i] = clone(futexworker, (void*)ITERS, stacks + (i+1)*STACK);
+    if(tids[i] < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  mutex_lock(&futexmu);
+  while(futexdone < N)
+    cond_wait(&futexcv, &futexmu);
+  mutex_unlock(&futexmu);
+  for(i = 0; i < N; i++)
+    join(tids[i], 0);
+  if(futexcount != N * ITERS){
+    printf("%s: count %d, want %d\n", s, futexcount, N * ITERS);
+    exit(1);
+  }
+}
+
+// lockstat() reports locks by name, and counts acquisitions.
+void
+lockstattest(char *s)
+{
+  static struct lockstat ls[NLOCKCLASS];
+  int i, n;
+
+  n = lockstat(ls, NLOCKCLASS);
+  if(n < 2 || n > NLOCKCLASS){
+    printf("%s: lockstat returned %d\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < n; i++)
+    if(strcmp(ls[i].name, "proc") == 0)
+      break;
+  if(i == n || ls[i].nacquire == 0 || ls[i].ncontended > ls[i].nacquire){
+    printf("%s: no sensible count for proc locks\n", s);
+    exit(1);
+  }
+}
+
+// the profiler samples a busy process, and stops when told.
+void
+proftest(char *s)
+{
+  static struct profsample ps[64];
+  int i, n, t0, mine;
+
+  profile(1);
+  t0 = uptime();
+  while(uptime() - t0 < 3)
+    ;
+  profile(0);
+  n = profread(ps, 64);
+  if(n <= 0){
+    printf("%s: no samples\n", s);
+    exit(1);
+  }
+  mine = 0;
+  for(i = 0; i < n; i++){
+    if(ps[i].cpu < 0 || ps[i].cpu >= NCPU || (ps[i].user != 0 && ps[i].user != 1)){
+      printf("%s: bad sample\n", s);
+      exit(1);
+    }
+    if(ps[i].pid == getpid())
+      mine++;
+  }
+  if(mine == 0){
+    printf("%s: no samples of this process\n", s);
+    exit(1);
+  }
+  while(profread(ps, 64) > 0)
+    ;
+  sleep(2);
+  if(profread(ps, 64) != 0){
+    printf("%s: sampled after profile(0)\n", s);
+    exit(1);
+  }
+}
+
+// a pipe round trip is traced as a sleep and a wakeup
+// on the same channel, in time order on each cpu.
+void
+tracetest(char *s)
+{
+  static struct traceevent te[64];
+  int fds[2], pid, i, n, nsleep, nwake;
+  uint64 last[NCPU];
+  char c;
+
+  tracectl(0);
+  while(traceread(te, 64) > 0)
+    ;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  tracectl((1 << TR_SLEEP) | (1 << TR_WAKEUP));
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(fds[1], "x", 1);
+    exit(0);
+  }
+  if(read(fds[0], &c, 1) != 1){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  wait(0);
+  tracectl(0);
+  close(fds[0]);
+  close(fds[1]);
+
+  nsleep = nwake = 0;
+  memset(last, 0, sizeof(last));
+  while((n = traceread(te, 64)) > 0){
+    for(i = 0; i < n; i++){
+      if(te[i].cpu >= NCPU || te[i].time < last[te[i].cpu] ||
+         (te[i].event != TR_SLEEP && te[i].event != TR_WAKEUP)){
+        printf("%s: bad event\n", s);
+        exit(1);
+      }
+      last[te[i].cpu] = te[i].time;
+      if(te[i].pid == getpid() && te[i].event == TR_SLEEP)
+        nsleep++;
+      if(te[i].event == TR_WAKEUP && te[i].arg[1] > 0)
+        nwake++;
+    }
+  }
+  if(nsleep == 0 || nwake == 0){
+    printf("%s: missing sleep or wakeup\n", s);
+    exit(1);
+  }
+}
+
+// calls made through the system call ring behave like the
+// system calls, and a forked child has no ring.
+void
+ringtest(char *s)
+{
+  struct ring *r;
+  struct stat st;
+  int sw[2], want[] = { 5, 0, 0, -1 };
+  int fd, i, pid, xstatus;
+  uint t;
+
+  if((r = ringsetup()) == (struct ring*)-1){
+    printf("%s: ringsetup failed\n", s);
+    exit(1);
+  }
+  if(ringsetup() != r){
+    printf("%s: second ringsetup moved the ring\n", s);
+    exit(1);
+  }
+
+  t = r->sqtail;
+  r->sq[t % RINGSIZE] = (struct ringsqe){ .op = RING_OPEN, .addr = (uint64)"ringfile",
+                                          .n = O_CREATE|O_RDWR, .data = 1 };
+  r->sq[(t+1) % RINGSIZE] = (struct ringsqe){ .op = RING_SWAPSTAT, .addr = (uint64)sw, .data = 2 };
+  r->sq[(t+2) % RINGSIZE] = (struct ringsqe){ .op = 99, .data = 3 };
+  __atomic_store_n(&r->sqtail, t + 3, __ATOMIC_RELEASE);
+  if(ringenter(0) != 3 || r->cqtail - r->cqhead != 3){
+    printf("%s: ringenter did not run 3 calls\n", s);
+    exit(1);
+  }
+  fd = r->cq[r->cqhead % RINGSIZE].res;
+  if(fd < 0 || r->cq[r->cqhead % RINGSIZE].data != 1 ||
+     r->cq[(r->cqhead+1) % RINGSIZE].res != 0 ||
+     r->cq[(r->cqhead+2) % RINGSIZE].res != -1){
+    printf("%s: bad completions for open, swapstat, unknown op\n", s);
+    exit(1);
+  }
+  r->cqhead += 3;
+
+  t = r->sqtail;
+  r->sq[t % RINGSIZE] = (struct ringsqe){ .op = RING_WRITE, .fd = fd, .addr = (uint64)"hello", .n = 5 };
+  r->sq[(t+1) % RINGSIZE] = (struct ringsqe){ .op = RING_FSTAT, .fd = fd, .addr = (uint64)&st };
+  r->sq[(t+2) % RINGSIZE] = (struct ringsqe){ .op = RING_CLOSE, .fd = fd };
+  r->sq[(t+3) % RINGSIZE] = (struct ringsqe){ .op = RING_READ, .fd = fd, .addr = (uint64)&st, .n = 1 };
+  __atomic_store_n(&r->sqtail, t + 4, __ATOMIC_RELEASE);
+  if(ringenter(0) != 4){
+    printf("%s: ringenter did not run 4 calls\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    if(r->cq[(r->cqhead+i) % RINGSIZE].res != want[i]){
+      printf("%s: call %d returned %d\n", s, i, r->cq[(r->cqhead+i) % RINGSIZE].res);
+      exit(1);
+    }
+  }
+  r->cqhead += 4;
+  if(st.size != 5){
+    printf("%s: fstat through the ring saw size %ld\n", s, st.size);
+    exit(1);
+  }
+  unlink("ringfile");
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(ringenter(0) == -1 ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child has a ring\n", s);
+    exit(1);
+  }
+}
+
+// the kernel's data page gives the same clock as the system
+// calls, and user code cannot write it.
+int _uptime(void);
+uint64 _uptime_ns(void);
+
+void
+vdatatest(char *s)
+{
+  struct vdata *vd = (struct vdata*)VDATA;
+  uint64 n0, n1, n2;
+  int t0, t1, t2, pid, xstatus;
+
+  if(vd->timebase == 0 || vd->tickinterval == 0){
+    printf("%s: data page not filled in\n", s);
+    exit(1);
+  }
+  n0 = uptime_ns();
+  n1 = _uptime_ns();
+  n2 = uptime_ns();
+  t0 = uptime();
+  t1 = _uptime();
+  t2 = uptime();
+  if(n0 > n1 || n1 > n2 || t0 > t1 || t1 > t2 || vd->ticks > t2){
+    printf("%s: clocks disagree\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    vd->ticks = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: wrote the data page\n", s);
+    exit(1);
+  }
+}
+
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -2609,6 +3393,20 @@ struct test {
   {dirtest, "dirtest"},
   {exectest, "exectest"},
   {pipe1, "pipe1"},
+  {sendfiletest, "sendfile"},
+  {preadwrite, "preadwrite"},
+  {hugewrite, "hugewrite"},
+  {pagecache, "pagecache"},
+  {sharedread, "sharedread"},
+  {sharedlock, "sharedlock"},
+  {manyfds, "manyfds"},
+  {clonetest, "clonetest"},
+  {futextest, "futextest"},
+  {lockstattest, "lockstattest"},
+  {proftest, "proftest"},
+  {tracetest, "tracetest"},
+  {ringtest, "ringtest"},
+  {vdatatest, "vdatatest"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2939,6 +3737,162 @@ outofinodes(char *s)
   }
 }
 
+// Grow the heap a page at a time, touching each page, until
+// the kernel has written at least n sectors to swap or memory
+// runs out, then give it all back. Returns the sectors written.
+int
+forceswap(int n)
+{
+  char *start, *p;
+  int r, w0, w;
+
+  swapstat(&r, &w0);
+  w = w0;
+  start = sbrk(0);
+  for(p = start; w - w0 < n; p += PGSIZE){
+    if(sbrk(PGSIZE) == (char*)-1)
+      break;
+    *p = 1;
+    swapstat(&r, &w);
+  }
+  sbrk(-(sbrk(0) - start));
+  return w - w0;
+}
+
+// the kernel's data page, mapped by every process that fork
+// makes, must never be swapped out or freed.
+void
+vdataswap(char *s)
+{
+  struct vdata *vd = (struct vdata*)VDATA;
+  int i, pid, t0;
+
+  for(i = 0; i < 100; i++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  t0 = vd->ticks;
+  if(forceswap(4000) == 0){
+    printf("%s: nothing was swapped out\n", s);
+    exit(1);
+  }
+  sleep(2);
+  if(vd->timebase == 0 || vd->ticks <= t0 || vd->ticks > _uptime()){
+    printf("%s: data page lost\n", s);
+    exit(1);
+  }
+}
+
+// fill buf with n bytes of the pattern for file offset off.
+static void
+wbfill(char *b, int off, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    b[i] = (off + i) % 251;
+}
+
+// file data written into the page cache must reach the disk:
+// read it back after memory pressure has evicted the pages.
+void
+writeback(char *s)
+{
+  int fd, off, n;
+  char b[1000], c[1000];
+
+  unlink("writeback");
+  if((fd = open("writeback", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create writeback failed\n", s);
+    exit(1);
+  }
+  for(off = 0; off < 3*PGSIZE; off += n){
+    n = 3*PGSIZE - off < sizeof(b) ? 3*PGSIZE - off : sizeof(b);
+    wbfill(b, off, n);
+    if(write(fd, b, n) != n){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  sync();
+  // dirty a page again after it was written out.
+  memset(b, 'x', 600);
+  if(pwrite(fd, b, 600, 5000) != 600){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(forceswap(100) == 0){
+    printf("%s: could not force swapping\n", s);
+    exit(1);
+  }
+  if((fd = open("writeback", O_RDONLY)) < 0){
+    printf("%s: open writeback failed\n", s);
+    exit(1);
+  }
+  for(off = 0; off < 3*PGSIZE; off += n){
+    n = 3*PGSIZE - off < sizeof(b) ? 3*PGSIZE - off : sizeof(b);
+    wbfill(c, off, n);
+    if(off == 5000)
+      memset(c, 'x', 600);
+    if(read(fd, b, n) != n || memcmp(b, c, n) != 0){
+      printf("%s: wrong data at %d\n", s, off);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  // truncating drops dirty pages unwritten.
+  if((fd = open("writeback", O_TRUNC|O_RDWR)) < 0 ||
+     write(fd, "zzz", 3) != 3){
+    printf("%s: rewrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  forceswap(100);
+  fd = open("writeback", O_RDONLY);
+  if(read(fd, b, sizeof(b)) != 3 || memcmp(b, "zzz", 3) != 0){
+    printf("%s: wrong data after truncate\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("writeback");
+}
+
+// a system call ring stays in memory, where the kernel
+// writes it by physical address, while memory is swapped.
+void
+ringswap(char *s)
+{
+  struct ring *r;
+  struct ringsqe *e;
+
+  if((r = ringsetup()) == (struct ring*)-1){
+    printf("%s: ringsetup failed\n", s);
+    exit(1);
+  }
+  if(forceswap(4000) == 0){
+    printf("%s: nothing was swapped out\n", s);
+    exit(1);
+  }
+  e = &r->sq[r->sqtail % RINGSIZE];
+  e->op = RING_NOP;
+  e->data = 42;
+  __atomic_store_n(&r->sqtail, r->sqtail + 1, __ATOMIC_RELEASE);
+  if(ringenter(0) != 1 || r->cqtail != r->cqhead + 1 ||
+     r->cq[r->cqhead % RINGSIZE].data != 42 ||
+     r->cq[r->cqhead % RINGSIZE].res != 0){
+    printf("%s: ring lost\n", s);
+    exit(1);
+  }
+}
+
 struct test slowtests[] = {
   {bigdir, "bigdir"},
   {manywrites, "manywrites"},
@@ -2946,6 +3900,9 @@ struct test slowtests[] = {
   {execout, "execout"},
   {diskfull, "diskfull"},
   {outofinodes, "outofinodes"},
+  {vdataswap, "vdataswap"},
+  {ringswap, "ringswap"},
+  {writeback, "writeback"},
     
   { 0, 0},
 };
@@ -6,24 +6,26 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# A call that ulib.c wraps gets its stub under another name.
 sub entry {
-    my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my ($name, $stub) = @_;
+    $stub = $name unless defined $stub;
+    print ".global $stub\n";
+    print "${stub}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
-entry("close");
+entry("close", "_close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -35,9 +37,29 @@ entry("dup");
 entry("getpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
+entry("uptime", "_uptime");
 # pa4: swap functions
 entry("swapread");
 entry("swapwrite");
 entry("swapstat");
+entry("sendfile");
+entry("splice");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("setpriority");
+entry("uptime_ns", "_uptime_ns");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("lockstat");
+entry("profile");
+entry("profread");
+entry("tracectl");
+entry("traceread");
+entry("ringsetup");
+entry("ringenter");
+entry("sync");
 